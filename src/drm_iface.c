@@ -16,6 +16,13 @@
 #include <linux/mutex.h>
 #include <linux/list.h>
 #include <linux/workqueue.h>
+#include <linux/bitmap.h>
+#include <linux/dma-fence.h>
+#include <linux/hrtimer.h>
+#include <linux/pm_runtime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/font.h>
 
 #include <linux/io.h>
 #include <linux/namei.h>
@@ -32,27 +39,56 @@
 #include <drm/drm_gem_atomic_helper.h>
 #include <drm/drm_gem_dma_helper.h>
 #include <drm/drm_gem_framebuffer_helper.h>
+#include <drm/drm_gem_shmem_helper.h>
 #include <drm/drm_managed.h>
 #include <drm/drm_modes.h>
 #include <drm/drm_rect.h>
 #include <drm/drm_probe_helper.h>
+#include <drm/drm_property.h>
 #include <drm/drm_simple_kms_helper.h>
+#include <drm/drm_vblank.h>
+#include <drm/drm_vma_manager.h>
+#include <drm/drm_writeback.h>
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
 #include <drm/clients/drm_client_setup.h>
 #include <drm/drm_fbdev_dma.h>
+#include <drm/drm_fbdev_shmem.h>
 #else
 #include <drm/drm_fbdev_generic.h>
 #endif
 
 #include "params_iface.h"
+#include "mono_convert.h"
 #include "ioctl_iface.h"
 #include "drm_iface.h"
+#include "fbdev_iface.h"
+#include "trace_format.h"
+#include "trace_iface.h"
 
 #define CMD_WRITE_LINE 0b10000000
 #define CMD_CLEAR_SCREEN 0b00100000
 #define CMD_TOGGLE_VCOM 0b01000000
 
+// Flushes are sent in chunks of at most this many lines, so that
+// interactive lines only wait for one chunk
+#define SHARP_MEMORY_CHUNK_LINES 16
+
+// Damage of at most this many panel lines is interactive
+#define SHARP_MEMORY_INTERACTIVE_LINES 16
+
+// Bus load is measured over windows of this length. Flushes are
+// interlaced once the lines marked in a window would take longer to send
+// than the window, and go back to whole frames below 70% of that
+#define SHARP_MEMORY_LOAD_WINDOW_MS 250
+#define SHARP_MEMORY_LOAD_ENTER_PERCENT 100
+#define SHARP_MEMORY_LOAD_EXIT_PERCENT 70
+#define SHARP_MEMORY_MAX_FIELDS 8
+
+// A flush is sent as a screen clear only if at most this many lines have
+// to be written again after it, so that the blank frame is never seen
+#define SHARP_MEMORY_CLEAR_REWRITE_LINES 32
+
 #define GPIO_BASE_ADDR 0x91105000
 #define GPIO_CS_PIN 14
 #define SPI_CS_ADDR1 0x9140b004
@@ -67,6 +103,16 @@ struct overlay_storage_t
 {
 	struct list_head list;
 	struct sharp_overlay_t overlay;
+	struct overlay_text_t *text; // NULL for pixel overlays
+	void *owner; // NULL for overlays added by kernel callers
+};
+
+// Text overlays keep their characters, `overlay` holds their position and
+// the extent of the current text
+struct overlay_text_t
+{
+	struct sharp_text_t text;
+	unsigned char chars[SHARP_MEMORY_TEXT_MAX];
 };
 
 struct overlay_display_t
@@ -78,6 +124,132 @@ struct overlay_display_t
 static LIST_HEAD(g_overlays);
 static LIST_HEAD(g_visible_overlays);
 
+// Protects both overlay lists. Taken inside `flush_lock` when drawing
+static DEFINE_MUTEX(g_overlays_lock);
+
+// Indicators are small overlays that can be shown and hidden from any
+// context, for example modifier state from an input handler. The list and
+// `visible` are protected by `g_indicators_lock`
+struct sharp_memory_indicator
+{
+	struct list_head list;
+	struct sharp_overlay_t ov;
+	bool visible;
+};
+
+static LIST_HEAD(g_indicators);
+static DEFINE_SPINLOCK(g_indicators_lock);
+
+// Device used by the exported kernel API
+static struct drm_device *g_drm = NULL;
+
+// Per-commit overrides from connector properties, -1 follows the module
+// parameter
+struct sharp_memory_connector_state
+{
+	struct drm_connector_state base;
+	struct sharp_memory_profile profile;
+};
+
+static inline struct sharp_memory_connector_state *
+to_sharp_memory_connector_state(struct drm_connector_state *state)
+{
+	return container_of(state, struct sharp_memory_connector_state, base);
+}
+
+// Overlay planes, composited above the primary plane and below overlays
+// added through the overlay ioctls
+#define SHARP_MEMORY_OVERLAY_PLANES 2
+
+// Overlay plane pixels equal to `key` are transparent, -1 for none
+struct sharp_memory_plane_state
+{
+	struct drm_plane_state base;
+	int key;
+};
+
+static inline struct sharp_memory_plane_state *
+to_sharp_memory_plane_state(struct drm_plane_state *state)
+{
+	return container_of(state, struct sharp_memory_plane_state, base);
+}
+
+// Committed overlay plane image at panel resolution, so that transfers
+// can composite it without reading the framebuffer again. `ov`, `key`
+// and `visible` are protected by `flush_lock`
+struct sharp_memory_plane
+{
+	struct drm_plane base;
+	u8 *pixels;
+	struct sharp_overlay_t ov;
+	int key;
+	bool visible;
+};
+
+static inline struct sharp_memory_plane *
+to_sharp_memory_plane(struct drm_plane *plane)
+{
+	return container_of(plane, struct sharp_memory_plane, base);
+}
+
+// Largest cursor image, in framebuffer pixels
+#define SHARP_MEMORY_CURSOR_SIZE 64
+
+// Cursor image converted to mono once per new image, at panel resolution.
+// Moving the cursor only resends the lines it left and entered. `cur` and
+// `visible` are protected by `flush_lock`
+struct sharp_memory_cursor
+{
+	struct drm_plane base;
+	u8 *mask, *image;
+	struct sharp_cursor_t cur;
+	bool visible;
+};
+
+static inline struct sharp_memory_cursor *
+to_sharp_memory_cursor(struct drm_plane *plane)
+{
+	return container_of(plane, struct sharp_memory_cursor, base);
+}
+
+// Maximum number of bands a conversion is split into
+#define SHARP_MEMORY_MAX_BANDS 8
+
+// Rows of one conversion handled by one CPU
+struct sharp_memory_band
+{
+	struct work_struct work;
+	u8 *dst;
+	u8 const *src;
+	int width;
+	int height;
+	int y0;
+	int scale;
+	struct sharp_memory_profile const *profile;
+};
+
+// Bus load over the current window, and the mode it selects. While
+// `interlaced`, a flush only sends every `fields`-th dirty line, starting
+// at line `field`, and the others keep their newest contents for the
+// next flush
+struct sharp_memory_load
+{
+	ktime_t start;
+	u64 marked;
+	u64 sent;
+	u64 busy_ns;
+	unsigned int percent;
+
+	bool interlaced;
+	unsigned int fields;
+	unsigned int field;
+
+	u64 enters;
+	u64 exits;
+	u64 interlaced_flushes;
+	u64 clear_flushes;
+};
+
 struct sharp_memory_panel
 {
 	struct drm_device drm;
@@ -90,19 +262,138 @@ struct sharp_memory_panel
 	struct timer_list vcom_timer;
 	struct work_struct vcom_work;
 
+	// Panel dimensions, framebuffer is `width / scale` by `height / scale`
 	unsigned int height;
 	unsigned int width;
+	unsigned int scale;
 
+	// Serializes users of the conversion buffer `buf` and the mono shadow
+	struct mutex flush_lock;
 	unsigned char *buf;
 	struct spi_transfer *spi_3_xfers;
 	unsigned char *cmd_buf;
 	unsigned char *trailer_buf;
 
+	// Display is powered while the pipe or the mono fbdev is using it
+	struct mutex power_lock;
+	int power_users;
+	bool pipe_powered;
+
+	// Handoff from a previous driver or bootloader image: the first power
+	// on keeps the panel contents and only waits out the part of the
+	// power-up delay not already spent since probe raised DISP
+	bool handoff;
+	ktime_t probe_time;
+	struct work_struct setup_work;
+
+	// Suspended with power users: VCOM and DISP are parked and transfers
+	// are held back until the shadow is retransmitted on resume
+	bool parked;
+
 	struct gpio_desc *gpio_disp;
 	struct gpio_desc *gpio_vcom;
 	struct gpio_desc *gpio_cs;
 
 	struct file *qemu_file; /* non-NULL when qemu_display_dev is used */
+	struct mutex qemu_lock; /* keeps serial writes whole */
+
+	// Framebuffers are backed by cached shmem pages instead of DMA memory
+	bool shmem;
+
+	// Driver-owned tagged line buffer that userspace can map and flush
+	struct drm_gem_dma_object *wire;
+
+	// Mono shadow of every panel line in tagged format, before overlays
+	// and inversion. Lines changed since the last transfer are `dirty`.
+	// Both are protected by `flush_lock`
+	u8 *mono;
+	unsigned long *dirty;
+
+	// Lines still showing the image handed off at probe. The shadow
+	// doesn't have their contents, so they are only sent once drawn.
+	// Protected by `flush_lock`
+	unsigned long *adopted;
+
+	// Grayscale copy of the last conversion of each framebuffer row, so
+	// that a settings change can re-threshold without reading the
+	// framebuffer again. Rows written as mono have no valid gray copy.
+	// `applied` is the profile the shadow was last brought up to date
+	// with. All are protected by `flush_lock`
+	u8 *gray;
+	unsigned long *gray_valid;
+	struct sharp_memory_profile applied;
+
+	// Only one transfer is built and sent from `tx` at a time
+	struct mutex tx_lock;
+	u8 *tx;
+
+	// Interactive lines: small damage and indicator changes. They are
+	// sent between the chunks of a flush, or by `urgent_work` when no
+	// flush is running. `urgent` is protected by `urgent_lock`. The lines
+	// a flush still has to send, `pending`, and the lines of the chunk
+	// being built, `chunk`, are protected by `tx_lock`
+	spinlock_t urgent_lock;
+	unsigned long *urgent;
+	unsigned long *pending;
+	unsigned long *chunk;
+	struct work_struct urgent_work;
+
+	// Overload detection, protected by `flush_lock`
+	struct sharp_memory_load load;
+
+	// Asynchronous transfers, and fences signaled when they complete
+	struct workqueue_struct *flush_wq;
+	struct work_struct flush_work;
+	struct work_struct params_work;
+
+	// Parallel conversion, bands are only used under `flush_lock`
+	struct workqueue_struct *convert_wq;
+	struct sharp_memory_band *bands;
+	spinlock_t fence_lock;
+	u64 fence_context;
+	u64 fence_seqno;
+	struct list_head fences;
+
+	// Emulated vblank at the rate a full frame can be sent, and the flip
+	// event waiting on the flush that carries its damage
+	struct hrtimer vblank_timer;
+	ktime_t frame_period;
+	struct drm_pending_vblank_event *flip_event;
+
+	// Connector properties, and the overrides from the last commit that
+	// set them, protected by `flush_lock`
+	struct drm_property *cutoff_prop;
+	struct drm_property *invert_prop;
+	struct drm_property *dither_prop;
+	struct sharp_memory_profile override;
+
+	// Overlay planes and their transparency key property
+	struct sharp_memory_plane planes[SHARP_MEMORY_OVERLAY_PLANES];
+	struct drm_property *key_prop;
+	struct sharp_memory_cursor cursor;
+
+	// Tagged lines as last sent to the panel, with overlays and inversion
+	// applied, lines known to match the panel, and lines that are all
+	// white on it. Protected by `flush_lock`
+	u8 *glass;
+	unsigned long *glass_valid;
+	unsigned long *blank;
+
+	// Writeback connector, and the framebuffer of the job waiting for the
+	// flush of its commit. Flushes are numbered by `flush_seq`, and the
+	// job completes after flush `wb_seq`, the first one started once its
+	// commit has updated the planes. 0 until then. All are protected by
+	// `flush_lock`
+	struct drm_writeback_connector wb;
+	struct drm_framebuffer *wb_fb;
+	u64 wb_seq;
+	u64 flush_seq;
+};
+
+struct sharp_memory_fence
+{
+	struct dma_fence base;
+	struct list_head list;
 };
 
 static inline struct sharp_memory_panel *drm_to_panel(struct drm_device *drm)
@@ -123,7 +414,11 @@ static int sharp_memory_qemu_write(struct sharp_memory_panel *panel,
 	const u8 *ptr = data;
 	size_t total = 0;
 	loff_t pos = 0;
+	int rc = 0;
 
+	mutex_lock(&panel->qemu_lock);
+
+	// Runs on the flush worker, never in the commit path
 	while (total < len) {
 		ssize_t written = kernel_write(panel->qemu_file, ptr + total,
 			len - total, &pos);
@@ -131,31 +426,39 @@ static int sharp_memory_qemu_write(struct sharp_memory_panel *panel,
 		if (written <= 0) {
 			printk(KERN_ERR "sharp_memory: qemu_write failed after %zu/%zu bytes: %zd\n",
 			       total, len, written);
-			return (written < 0) ? (int)written : -EIO;
+			rc = (written < 0) ? (int)written : -EIO;
+			break;
 		}
 
 		total += written;
-
-		if (need_resched()) {
-			cond_resched();
-		}
 	}
 
-	return 0;
+	mutex_unlock(&panel->qemu_lock);
+
+	return rc;
 }
 
 static int sharp_memory_spi_toggle_vcom(struct sharp_memory_panel *panel)
 {
 	int rc;
+	u8 tx_buf[2] = {CMD_TOGGLE_VCOM, 0x00};
+
+	if (panel == NULL) {
+		return 0;
+	}
+
+	// Emulated VCOM, so that the host side can check it keeps toggling
+	if (panel->qemu_file) {
+		return sharp_memory_qemu_write(panel, tx_buf, sizeof(tx_buf));
+	}
 
-	if ((panel == NULL) || (panel->spi == NULL)) {
+	if (panel->spi == NULL) {
 		return 0;
 	}
 
 	struct spi_message m;
 	spi_message_init(&m);
 
-	u8 tx_buf[2] = {CMD_TOGGLE_VCOM, 0x00};
 	struct spi_transfer t = {
 		.tx_buf = tx_buf,
 		.len = sizeof(tx_buf),
@@ -194,7 +497,10 @@ static void vcom_timer_callback(struct timer_list *t)
 		vcom_setting = (vcom_setting) ? 0 : 1;
 		gpiod_set_value(panel->gpio_vcom, vcom_setting);
 
-	// Send VCOM command
+	// Send VCOM command. QEMU writes go through the flush worker so
+	// that they never land in the middle of a frame
+	} else if (panel->qemu_file) {
+		queue_work(panel->flush_wq, &panel->vcom_work);
 	} else {
 		schedule_work(&panel->vcom_work);
 	}
@@ -238,30 +544,24 @@ static int sharp_memory_spi_clear_screen(struct sharp_memory_panel *panel)
 	return rc;
 }
 
-static inline u8 sharp_memory_reverse_byte(u8 b)
-{
-	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
-	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
-	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
-	return b;
-}
-
+// `line_data` must have one writable byte before and after it
 static int sharp_memory_spi_write_tagged_lines(struct sharp_memory_panel *panel,
 	void *line_data, size_t len)
 {
 	int rc;
+	u8 *frame;
 
 	if (panel == NULL) {
 		return 0;
 	}
 
+	// Command and trailer go around the lines so that the whole frame is
+	// one write
 	if (panel->qemu_file) {
-		u8 cmd = CMD_WRITE_LINE;
-		u8 trailer = 0;
-		rc = sharp_memory_qemu_write(panel, &cmd, 1);
-		if (!rc) rc = sharp_memory_qemu_write(panel, line_data, len);
-		if (!rc) rc = sharp_memory_qemu_write(panel, &trailer, 1);
-		return rc;
+		frame = (u8 *)line_data - 1;
+		frame[0] = CMD_WRITE_LINE;
+		frame[len + 1] = 0;
+		return sharp_memory_qemu_write(panel, frame, len + 2);
 	}
 
 	if (panel->spi == NULL) {
@@ -302,770 +602,3599 @@ static int sharp_memory_spi_write_tagged_lines(struct sharp_memory_panel *panel,
 	return rc;
 }
 
-static void draw_overlays(struct sharp_memory_panel *panel, u8* buf, int width,
-	struct drm_rect const* clip)
+// Resolve connector overrides against module parameters. Caller holds
+// `flush_lock`
+static void sharp_memory_get_profile(struct sharp_memory_panel *panel,
+	struct sharp_memory_profile *profile)
+{
+	struct sharp_memory_profile const *override = &panel->override;
+
+	profile->cutoff = (override->cutoff >= 0)
+		? override->cutoff
+		: READ_ONCE(g_param_mono_cutoff);
+	profile->invert = (override->invert >= 0)
+		? override->invert
+		: READ_ONCE(g_param_mono_invert);
+	profile->dither = (override->dither >= 0)
+		? override->dither
+		: READ_ONCE(g_param_mono_dither);
+}
+
+// Draw overlays onto tagged mono lines [y1, y2) in panel coordinates.
+// Overlays are drawn after conversion so that they keep full panel
+// resolution when the framebuffer is downscaled. Inversion is applied
+// to the whole line afterwards.
+static void draw_overlays(struct sharp_memory_panel *panel, u8 *buf,
+	int y1, int y2, struct sharp_memory_profile const *profile)
 {
-	int x, y, dx, dy, sx, sy;
 	struct overlay_display_t *p;
-	struct sharp_overlay_t const *ov;
 
+	mutex_lock(&g_overlays_lock);
 	list_for_each_entry(p, &g_visible_overlays, list) {
-		ov = &p->storage->overlay;
-		x = (ov->x < 0) ? (panel->width + ov->x) : ov->x;
-		y = (ov->y < 0) ? (panel->height + ov->y) : ov->y;
+		if (p->storage->text) {
+			sharp_memory_draw_text(buf, panel->width, panel->height, y1, y2,
+				&p->storage->overlay, &p->storage->text->text);
+		} else {
+			sharp_memory_draw_overlay(buf, panel->width, panel->height, y1, y2,
+				&p->storage->overlay, profile->cutoff);
+		}
+	}
+	mutex_unlock(&g_overlays_lock);
+}
 
-		// Any overlap?
-		if (((y + ov->height) < clip->y1) || (clip->y2 < y)) {
-			continue;
+// Draw visible indicators onto tagged mono lines [y1, y2), above overlays
+static void draw_indicators(struct sharp_memory_panel *panel, u8 *buf,
+	int y1, int y2, struct sharp_memory_profile const *profile)
+{
+	struct sharp_memory_indicator *p;
+	unsigned long flags;
+
+	spin_lock_irqsave(&g_indicators_lock, flags);
+	list_for_each_entry(p, &g_indicators, list) {
+		if (p->visible) {
+			sharp_memory_draw_overlay(buf, panel->width, panel->height,
+				y1, y2, &p->ov, profile->cutoff);
 		}
+	}
+	spin_unlock_irqrestore(&g_indicators_lock, flags);
+}
 
-		// Draw overlay pixels
-		for (sy = 0; sy < ov->height; sy++) {
+// Draw the committed overlay planes onto tagged mono lines [y1, y2) in
+// panel coordinates. Caller holds `flush_lock`
+static void draw_planes(struct sharp_memory_panel *panel, u8 *buf,
+	int y1, int y2, struct sharp_memory_profile const *profile)
+{
+	int i;
+	struct sharp_memory_plane const *plane;
+
+	for (i = 0; i < SHARP_MEMORY_OVERLAY_PLANES; i++) {
+		plane = &panel->planes[i];
+		if (plane->visible) {
+			sharp_memory_draw_overlay_keyed(buf, panel->width, panel->height,
+				y1, y2, &plane->ov, profile->cutoff, plane->key);
+		}
+	}
+}
 
-			// Skip lines before clip
-			if ((y + sy) < clip->y1) {
-				continue;
-			// Exit if reached end of clip
-			} else if (clip->y2 <= (y + sy)) {
-				break;
-			}
+static void sharp_memory_convert_band(struct sharp_memory_band *band)
+{
+	if (band->scale == 2) {
+		(void)sharp_memory_gray8_to_mono_tagged_2x(band->dst, band->src,
+			band->width, band->height, band->y0, band->profile);
+	} else {
+		(void)sharp_memory_gray8_to_mono_tagged(band->dst, band->src,
+			band->width, band->height, band->y0, band->profile);
+	}
+}
 
-			dy = sy - clip->y1;
+static void sharp_memory_band_work(struct work_struct *work)
+{
+	sharp_memory_convert_band(container_of(work, struct sharp_memory_band, work));
+}
 
-			for (sx = 0; sx < ov->width; sx++) {
+// Convert framebuffer rows [y1, y2) of `width` gray bytes from `src` to
+// tagged panel lines in `dst`. Large conversions from a separate source
+// are split into bands run on the other CPUs while this one converts the
+// first band, and are all finished on return. Caller holds `flush_lock`
+static size_t sharp_memory_gray8_convert(struct sharp_memory_panel *panel,
+	u8 *dst, u8 const *src, int width, int y1, int y2,
+	struct sharp_memory_profile const *profile)
+{
+	int i, nbands, band_rows, row;
+	int const rows = y2 - y1;
+	int const min_rows = READ_ONCE(g_param_parallel_rows);
+	size_t const out_row_len = panel->scale * (2 + (panel->scale * width) / 8);
+	struct sharp_memory_band *band;
 
-				if (sx < clip->x1) {
-					continue;
-				} else if (clip->x2 <= sx) {
-					break;
-				}
+	if (rows <= 0) {
+		return 0;
+	}
 
-				dx = (x + sx) - clip->x1;
-				buf[(y + dy) * (clip->x2 - clip->x1) + dx]
-					= ov->pixels[(sy * ov->width) + sx];
-			}
+	// Bands write to disjoint parts of `dst`, which only works if no band
+	// reads from a part another band writes
+	nbands = 1;
+	if (min_rows && (rows >= min_rows) && (dst != src)) {
+		nbands = clamp_t(int, num_online_cpus(), 1, SHARP_MEMORY_MAX_BANDS);
+	}
+	band_rows = DIV_ROUND_UP(rows, nbands);
+
+	for (i = 0, row = 0; (i < nbands) && (row < rows); i++, row += band_rows) {
+		band = &panel->bands[i];
+		band->dst = dst + (row * out_row_len);
+		band->src = src + (row * width);
+		band->width = width;
+		band->height = min(band_rows, rows - row);
+		band->y0 = (y1 + row) * panel->scale;
+		band->scale = panel->scale;
+		band->profile = profile;
+
+		if (i > 0) {
+			queue_work(panel->convert_wq, &band->work);
 		}
 	}
-}
+	nbands = i;
 
-static size_t sharp_memory_gray8_to_mono_tagged(u8 *buf, int width, int height, int y0)
-{
-	int line, b8, b1;
-	unsigned char d;
-	int const tagged_line_len = 2 + width / 8;
+	sharp_memory_convert_band(&panel->bands[0]);
+	for (i = 1; i < nbands; i++) {
+		flush_work(&panel->bands[i].work);
+	}
 
-	// Iterate over lines from [0, height)
-	for (line = 0; line < height; line++) {
+	return rows * out_row_len;
+}
 
-		// Iterate over chunks of 8 source grayscale bytes
-		// Each 8-byte source chunk will map to one destination mono byte
-		for (b8 = 0; b8 < width; b8 += 8) {
-			d = 0;
+static const char *sharp_memory_fence_get_driver_name(struct dma_fence *fence)
+{
+	return "sharp_drm";
+}
 
-			// Iterate over each of the 8 grayscale bytes in the chunk
-			// Build up the destination mono byte
-			for (b1 = 0; b1 < 8; b1++) {
+static const char *sharp_memory_fence_get_timeline_name(struct dma_fence *fence)
+{
+	return "spi";
+}
 
-				// Change at what gray level the mono pixel is active here
-				if (buf[(line * width) + b8 + b1] >= g_param_mono_cutoff) {
-					d |= 0b10000000 >> b1;
-				}
-			}
+static const struct dma_fence_ops sharp_memory_fence_ops = {
+	.get_driver_name = sharp_memory_fence_get_driver_name,
+	.get_timeline_name = sharp_memory_fence_get_timeline_name,
+};
 
-			// Apply inversion
-			if (g_param_mono_invert) {
-				d = ~d;
-			}
+static void sharp_memory_signal_fences(struct list_head *fences, int rc)
+{
+	struct sharp_memory_fence *fence, *next;
 
-			// Without the line number and trailer tags, each destination
-			// mono line would have a length `width / 8`. However, we are
-			// inserting the line number at the beginning of the line and
-			// the zero-byte trailer at the end.
-			// So the destination mono line is at index
-			// `line * tagged_line_len = line * (2 + width / 8)`
-			// The destination mono byte is offset by 1 to make room for
-			// the line tag, written at the end of converting the current
-			// line.
-			buf[(line * tagged_line_len) + 1 + (b8 / 8)] = d;
+	list_for_each_entry_safe(fence, next, fences, list) {
+		list_del(&fence->list);
+		if (rc) {
+			dma_fence_set_error(&fence->base, rc);
 		}
-
-		// Write the line number and trailer tags
-		buf[line * tagged_line_len] = sharp_memory_reverse_byte((u8)(y0 + 1)); // Indexed from 1
-		buf[(line * tagged_line_len) + tagged_line_len - 1] = 0;
-		y0++;
+		dma_fence_signal(&fence->base);
+		dma_fence_put(&fence->base);
 	}
-
-	return height * tagged_line_len;
 }
 
-// Use DMA to get grayscale representation, then convert to mono
-// with line number and trailer tags suitable for multi-line write
-// Output is stored in `buf`, which must be at least W*H bytes
-static int sharp_memory_clip_mono_tagged(struct sharp_memory_panel* panel, size_t* result_len,
-	u8* buf, struct drm_framebuffer *fb, struct drm_rect const* clip)
+// Mark shadow lines [y1, y2) for sending. Small updates, such as a
+// keystroke or a cursor, are also interactive. Caller holds `flush_lock`
+static void sharp_memory_mark_lines(struct sharp_memory_panel *panel,
+	int y1, int y2)
 {
-	int rc;
-	struct drm_gem_dma_object *dma_obj;
-	struct iosys_map dst, vmap;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
-	struct drm_format_conv_state fmtcnv_state = DRM_FORMAT_CONV_STATE_INIT;
-#endif
+	unsigned long flags;
 
-	// Get GEM memory manager
-	dma_obj = drm_fb_dma_get_gem_obj(fb, 0);
+	bitmap_set(panel->dirty, y1, y2 - y1);
+	panel->load.marked += y2 - y1;
 
-	// Start DMA area
-	rc = drm_gem_fb_begin_cpu_access(fb, DMA_FROM_DEVICE);
-	if (rc) {
-		return rc;
+	if ((y2 - y1) <= SHARP_MEMORY_INTERACTIVE_LINES) {
+		spin_lock_irqsave(&panel->urgent_lock, flags);
+		bitmap_set(panel->urgent, y1, y2 - y1);
+		spin_unlock_irqrestore(&panel->urgent_lock, flags);
 	}
+}
 
-	// Initialize destination (buf) and source (video)
-	iosys_map_set_vaddr(&dst, buf);
-	iosys_map_set_vaddr(&vmap, dma_obj->vaddr);
-	// DMA `clip` into `buf` and convert to 8-bit grayscale
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
-	drm_fb_xrgb8888_to_gray8(&dst, NULL, &vmap, fb, clip, &fmtcnv_state);
-#else
-	drm_fb_xrgb8888_to_gray8(&dst, NULL, &vmap, fb, clip);
-#endif
+// Copy tagged lines for panel lines [y1, y2) into the mono shadow and
+// mark them dirty. Caller holds `flush_lock`
+static void sharp_memory_store_lines(struct sharp_memory_panel *panel,
+	u8 const *buf, int y1, int y2)
+{
+	int const tagged_line_len = 2 + panel->width / 8;
+
+	memcpy(&panel->mono[y1 * tagged_line_len], buf,
+		(y2 - y1) * tagged_line_len);
+	sharp_memory_mark_lines(panel, y1, y2);
+}
 
-	// End DMA area
-	drm_gem_fb_end_cpu_access(fb, DMA_FROM_DEVICE);
+// Re-threshold every cached gray row into the mono shadow.
+// Caller holds `flush_lock`
+static void sharp_memory_rethreshold(struct sharp_memory_panel *panel,
+	struct sharp_memory_profile const *profile)
+{
+	unsigned int y1, y2;
+	int const fb_width = panel->width / panel->scale;
+	int const fb_height = panel->height / panel->scale;
 
-	// Add overlays
-	if (g_param_overlays) {
+	for_each_set_bitrange(y1, y2, panel->gray_valid, fb_height) {
+		(void)sharp_memory_gray8_convert(panel, panel->buf,
+			&panel->gray[y1 * fb_width], fb_width, y1, y2, profile);
 
-		// TODO: track overlay draw region
-		draw_overlays(panel, buf, fb->width, clip);
+		sharp_memory_store_lines(panel, panel->buf,
+			y1 * panel->scale, y2 * panel->scale);
 	}
+}
 
-	// Convert in-place from 8-bit grayscale to mono
-	*result_len = sharp_memory_gray8_to_mono_tagged(buf,
-		(clip->x2 - clip->x1), (clip->y2 - clip->y1), clip->y1);
+// Mark every line the shadow has contents for dirty, lines adopted at
+// probe keep their image. Caller holds `flush_lock`
+static void sharp_memory_mark_shadow(struct sharp_memory_panel *panel)
+{
+	unsigned int y1, y2;
 
-	// Success
-	return 0;
+	for_each_clear_bitrange(y1, y2, panel->adopted, panel->height) {
+		bitmap_set(panel->dirty, y1, y2 - y1);
+	}
 }
 
-static int sharp_memory_fb_dirty(struct drm_framebuffer *fb,
-	struct drm_rect const* dirty_rect)
+// Bring the mono shadow up to date with the current settings. Inversion
+// is applied on transfer, so an invert change only marks every line
+// dirty. Returns true if anything needs to be sent.
+// Caller holds `flush_lock`
+static bool sharp_memory_apply_profile(struct sharp_memory_panel *panel)
 {
-	int rc;
-	struct drm_rect clip;
-	struct sharp_memory_panel *panel;
-	int drm_idx;
-	size_t buf_len;
-
-	// Clip dirty region rows
-	clip.x1 = 0;
-	clip.x2 = fb->width;
-	clip.y1 = dirty_rect->y1;
-	clip.y2 = dirty_rect->y2;
+	struct sharp_memory_profile profile;
+	bool changed = false;
 
-	// Get panel info from DRM struct
-	panel = drm_to_panel(fb->dev);
+	sharp_memory_get_profile(panel, &profile);
 
-	// Enter DRM device resource area
-	if (!drm_dev_enter(fb->dev, &drm_idx)) {
-		return -ENODEV;
+	if ((profile.cutoff != panel->applied.cutoff)
+	 || (profile.dither != panel->applied.dither)) {
+		sharp_memory_rethreshold(panel, &profile);
+		changed = true;
 	}
 
-	// Convert `clip` from framebuffer to mono with line number tags
-	rc = sharp_memory_clip_mono_tagged(panel, &buf_len, panel->buf, fb, &clip);
-	if (rc) {
-		goto out_exit;
+	if (profile.invert != panel->applied.invert) {
+		sharp_memory_mark_shadow(panel);
+		changed = true;
 	}
 
-	// Write mono data to display
-	rc = sharp_memory_spi_write_tagged_lines(panel, panel->buf, buf_len);
-
-out_exit:
-	// Exit DRM device resource area
-	drm_dev_exit(drm_idx);
+	panel->applied = profile;
 
-	return rc;
+	return changed;
 }
 
-
-static void power_off(struct sharp_memory_panel *panel)
+// Mono rows were written directly to the shadow, drop their gray copy.
+// Caller holds `flush_lock`
+static void sharp_memory_invalidate_gray(struct sharp_memory_panel *panel,
+	int y1, int y2)
 {
-	printk(KERN_INFO "sharp_memory: powering off\n");
-
-	// Clear display if auto clear is set
-	if (g_param_auto_clear) {
-		(void)sharp_memory_spi_clear_screen(panel);
-	}
+	y1 = y1 / panel->scale;
+	y2 = DIV_ROUND_UP(y2, panel->scale);
 
-	/* Turn off power and all signals */
-	if (panel->gpio_disp) {
-		gpiod_set_value(panel->gpio_disp, 0);
-	}
-	if (panel->gpio_vcom) {
-		gpiod_set_value(panel->gpio_vcom, 0);
-	}
+	bitmap_clear(panel->gray_valid, y1, y2 - y1);
 }
 
-static void sharp_memory_pipe_enable(struct drm_simple_display_pipe *pipe,
-	struct drm_crtc_state *crtc_state, struct drm_plane_state *plane_state)
+// Map `fb` for CPU access. DMA memory is always mapped. Shmem pages are
+// mapped for the access, the mapping is cached by GEM while the fbdev or
+// a client holds one
+static int sharp_memory_fb_begin_access(struct sharp_memory_panel *panel,
+	struct drm_framebuffer *fb, struct iosys_map *vmap,
+	enum dma_data_direction dir)
 {
-	struct sharp_memory_panel *panel;
-	struct spi_device *spi;
-	int drm_idx;
-
-	printk(KERN_INFO "sharp_memory: entering sharp_memory_pipe_enable\n");
-
-	// Get panel and SPI device structs
-	panel = drm_to_panel(pipe->crtc.dev);
-	spi = panel->spi;
-
-	// Enter DRM resource area
-	if (!drm_dev_enter(pipe->crtc.dev, &drm_idx)) {
-		return;
-	}
+	int rc;
+	struct drm_gem_dma_object *dma_obj;
 
-	// Power up sequence
-	if (panel->gpio_disp) {
-		gpiod_set_value(panel->gpio_disp, 1);
-	}
-	if (panel->gpio_vcom) {
-		gpiod_set_value(panel->gpio_vcom, 0);
+	rc = drm_gem_fb_begin_cpu_access(fb, dir);
+	if (rc) {
+		return rc;
 	}
-	set_gpio_cs(panel, 1);
-	usleep_range(5000, 10000);
 
-	// Clear display
-	if (sharp_memory_spi_clear_screen(panel)) {
-		if (panel->gpio_disp) {
-			gpiod_set_value(panel->gpio_disp, 0); // Power down display, VCOM is not running
+	if (panel->shmem) {
+		rc = drm_gem_fb_vmap(fb, vmap, NULL);
+		if (rc) {
+			drm_gem_fb_end_cpu_access(fb, dir);
+			return rc;
 		}
-		goto out_exit;
+	} else {
+		dma_obj = drm_fb_dma_get_gem_obj(fb, 0);
+		iosys_map_set_vaddr(&vmap[0], dma_obj->vaddr);
 	}
 
-	// Initialize and schedule the VCOM timer
-	INIT_WORK(&panel->vcom_work, sharp_memory_vcom_work);
-	timer_setup(&panel->vcom_timer, vcom_timer_callback, 0);
-	mod_timer(&panel->vcom_timer, jiffies + msecs_to_jiffies(500));
+	return 0;
+}
 
-	printk(KERN_INFO "sharp_memory: completed sharp_memory_pipe_enable\n");
+static void sharp_memory_fb_end_access(struct sharp_memory_panel *panel,
+	struct drm_framebuffer *fb, struct iosys_map *vmap,
+	enum dma_data_direction dir)
+{
+	if (panel->shmem) {
+		drm_gem_fb_vunmap(fb, vmap);
+	}
 
-out_exit:
-	drm_dev_exit(drm_idx);
+	drm_gem_fb_end_cpu_access(fb, dir);
 }
 
-static void sharp_memory_pipe_disable(struct drm_simple_display_pipe *pipe)
+// Copy the panel image into a writeback framebuffer, R1 as sent or R8
+// with one byte per pixel. Caller holds `flush_lock`
+static int sharp_memory_capture(struct sharp_memory_panel *panel,
+	struct drm_framebuffer *fb)
 {
-	struct sharp_memory_panel *panel;
-	struct spi_device *spi;
+	int rc, x, y;
+	int const tagged_line_len = 2 + panel->width / 8;
+	struct iosys_map vmap[DRM_FORMAT_MAX_PLANES];
+	u8 const *src;
+	u8 *dst;
 
-	printk(KERN_INFO "sharp_memory: sharp_memory_pipe_disable\n");
+	rc = sharp_memory_fb_begin_access(panel, fb, vmap, DMA_TO_DEVICE);
+	if (rc) {
+		return rc;
+	}
 
-	// Get panel and SPI device structs
-	panel = drm_to_panel(pipe->crtc.dev);
-	spi = panel->spi;
+	for (y = 0; y < panel->height; y++) {
+		src = &panel->glass[(y * tagged_line_len) + 1];
+		dst = (u8 *)vmap[0].vaddr + fb->offsets[0] + (y * fb->pitches[0]);
 
-	// Cancel the timer
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
-	timer_delete_sync(&panel->vcom_timer);
-#else
-	del_timer_sync(&panel->vcom_timer);
-#endif
+		if (fb->format->format == DRM_FORMAT_R8) {
+			for (x = 0; x < panel->width; x++) {
+				dst[x] = (src[x / 8] & (0b10000000 >> (x % 8))) ? 0xff : 0;
+			}
+		} else {
+			memcpy(dst, src, panel->width / 8);
+		}
+	}
 
-	power_off(panel);
+	sharp_memory_fb_end_access(panel, fb, vmap, DMA_TO_DEVICE);
+
+	return 0;
 }
 
-static void sharp_memory_pipe_update(struct drm_simple_display_pipe *pipe,
-				struct drm_plane_state *old_state)
+// Capture the panel image for a queued writeback job and signal it.
+// `status` is used instead if it's an error. Caller holds `flush_lock`
+static void sharp_memory_complete_writeback(struct sharp_memory_panel *panel,
+	int status)
 {
-	struct drm_plane_state *state = pipe->plane.state;
-	struct drm_rect rect;
+	struct drm_framebuffer *fb = panel->wb_fb;
 
-	if (!pipe->crtc.state->active) {
+	if (!fb) {
 		return;
 	}
+	panel->wb_fb = NULL;
+	panel->wb_seq = 0;
 
-	if (drm_atomic_helper_damage_merged(old_state, state, &rect)) {
-		sharp_memory_fb_dirty(state->fb, &rect);
+	if (!status) {
+		status = sharp_memory_capture(panel, fb);
 	}
+	drm_writeback_signal_completion(&panel->wb, status);
 }
 
-static const struct drm_simple_display_pipe_funcs sharp_memory_pipe_funcs = {
-	.enable = sharp_memory_pipe_enable,
-	.disable = sharp_memory_pipe_disable,
-	.update = sharp_memory_pipe_update
-	// .prepare_fb and .cleanup_fb are handled automatically when not set
-};
-
-static int sharp_memory_connector_get_modes(struct drm_connector *connector)
+// Copy shadow lines set in `lines` into `tx` with overlays and inversion
+// applied. Caller holds `flush_lock`
+static size_t sharp_memory_compose_lines(struct sharp_memory_panel *panel,
+	unsigned long const *lines)
 {
-	struct sharp_memory_panel *panel = drm_to_panel(connector->dev);
+	unsigned int y1, y2;
+	int line, b;
+	int const tagged_line_len = 2 + panel->width / 8;
+	size_t len = 0;
+	u8 *dst;
+	struct sharp_memory_profile profile;
+
+	sharp_memory_get_profile(panel, &profile);
+
+	for_each_set_bitrange(y1, y2, lines, panel->height) {
+		dst = &panel->tx[len];
+		memcpy(dst, &panel->mono[y1 * tagged_line_len],
+			(y2 - y1) * tagged_line_len);
+
+		draw_planes(panel, dst, y1, y2, &profile);
+		if (g_param_overlays) {
+			draw_overlays(panel, dst, y1, y2, &profile);
+			draw_indicators(panel, dst, y1, y2, &profile);
+		}
+		if (panel->cursor.visible) {
+			sharp_memory_draw_cursor(dst, panel->width, y1, y2,
+				&panel->cursor.cur);
+		}
 
-	return drm_connector_helper_get_modes_fixed(connector, panel->mode);
+		// Invert pixel bytes, leaving line tags and trailers
+		if (profile.invert) {
+			for (line = 0; line < (y2 - y1); line++) {
+				for (b = 1; b < tagged_line_len - 1; b++) {
+					dst[(line * tagged_line_len) + b] ^= 0xff;
+				}
+			}
+		}
+
+		len += (y2 - y1) * tagged_line_len;
+	}
+
+	return len;
 }
 
+// Pixel bytes of a tagged line are all white
+static bool sharp_memory_line_blank(struct sharp_memory_panel *panel,
+	u8 const *line)
+{
+	return !memchr_inv(&line[1], 0xff, panel->width / 8);
+}
 
-// https://github.com/torvalds/linux/commit/4cd24d4b1a9548f42cdb7f449edc6f869a8ae730
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
-static struct drm_framebuffer* create_and_store_fb(struct drm_device *dev,
-	struct drm_file *file, const struct drm_format_info *info,
-	const struct drm_mode_fb_cmd2 *mode_cmd)
+// Compose shadow lines set in `lines` into `tx`, record them as the glass
+// contents, and clear them from `dirty`. Caller holds `flush_lock`
+static size_t sharp_memory_gather_lines(struct sharp_memory_panel *panel,
+	unsigned long *lines)
 {
-	struct sharp_memory_panel *panel = drm_to_panel(dev);
-	panel->fb = drm_gem_fb_create_with_dirty(dev, file, info, mode_cmd);
-	return panel->fb;
+	unsigned int y;
+	int const tagged_line_len = 2 + panel->width / 8;
+	size_t len;
+	u8 const *src;
+
+	len = sharp_memory_compose_lines(panel, lines);
+
+	src = panel->tx;
+	for_each_set_bit(y, lines, panel->height) {
+		memcpy(&panel->glass[y * tagged_line_len], src, tagged_line_len);
+		__assign_bit(y, panel->blank, sharp_memory_line_blank(panel, src));
+		src += tagged_line_len;
+	}
+	bitmap_or(panel->glass_valid, panel->glass_valid, lines, panel->height);
+	bitmap_andnot(panel->adopted, panel->adopted, lines, panel->height);
+
+	bitmap_andnot(panel->dirty, panel->dirty, lines, panel->height);
+
+	return len;
 }
-#else
-static struct drm_framebuffer* create_and_store_fb(struct drm_device *dev,
-	struct drm_file *file, const struct drm_mode_fb_cmd2 *mode_cmd)
+
+// Close the load window once it is long enough, and switch between whole
+// and interlaced flushes. Demand is the bus time the lines marked in the
+// window would take at the measured time per line sent.
+// Caller holds `flush_lock`
+static void sharp_memory_update_load(struct sharp_memory_panel *panel)
 {
-	struct sharp_memory_panel *panel = drm_to_panel(dev);
-	panel->fb = drm_gem_fb_create_with_dirty(dev, file, mode_cmd);
-	return panel->fb;
+	struct sharp_memory_load *load = &panel->load;
+	ktime_t const now = ktime_get();
+	u64 const window_ns = ktime_to_ns(ktime_sub(now, load->start));
+	unsigned int fields;
+
+	if (window_ns < SHARP_MEMORY_LOAD_WINDOW_MS * NSEC_PER_MSEC) {
+		return;
+	}
+
+	load->percent = (load->sent)
+		? div64_u64(load->marked * load->busy_ns * 100, load->sent * window_ns)
+		: 0;
+
+	fields = clamp(READ_ONCE(g_param_interlace), 1, SHARP_MEMORY_MAX_FIELDS);
+	if (!load->interlaced && (fields > 1)
+	 && (load->percent >= SHARP_MEMORY_LOAD_ENTER_PERCENT)) {
+		load->interlaced = true;
+		load->fields = fields;
+		load->field = 0;
+		load->enters++;
+	} else if (load->interlaced && ((fields <= 1)
+	 || (load->percent < SHARP_MEMORY_LOAD_EXIT_PERCENT))) {
+		load->interlaced = false;
+		load->exits++;
+	}
+
+	load->start = now;
+	load->marked = 0;
+	load->sent = 0;
+	load->busy_ns = 0;
 }
-#endif
 
-static const struct drm_connector_helper_funcs sharp_memory_connector_hfuncs = {
-	.get_modes = sharp_memory_connector_get_modes,
-};
+// Keep only the lines of the next field in `pending`.
+// Caller holds `flush_lock`
+static void sharp_memory_select_field(struct sharp_memory_panel *panel)
+{
+	struct sharp_memory_load *load = &panel->load;
+	unsigned int y;
 
-static const struct drm_connector_funcs sharp_memory_connector_funcs = {
-	.reset = drm_atomic_helper_connector_reset,
-	.fill_modes = drm_helper_probe_single_connector_modes,
-	.destroy = drm_connector_cleanup,
-	.atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
-	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
-};
+	for_each_set_bit(y, panel->pending, panel->height) {
+		if ((y % load->fields) != load->field) {
+			__clear_bit(y, panel->pending);
+		}
+	}
 
-static const struct drm_mode_config_funcs sharp_memory_mode_config_funcs = {
-	.fb_create = create_and_store_fb,
-	.atomic_check = drm_atomic_helper_check,
-	.atomic_commit = drm_atomic_helper_commit,
-};
+	load->field = (load->field + 1) % load->fields;
+	load->interlaced_flushes++;
+}
 
-static const uint32_t sharp_memory_formats[] = {
-	DRM_FORMAT_XRGB8888,
-};
+// Select the next lines to send into `chunk`: every interactive line if
+// there are any, otherwise up to `chunk_lines` of the lines left in
+// `pending`. Caller holds `tx_lock` and `flush_lock`, and gathers `chunk`
+// right after, so an indicator change made meanwhile is either drawn or
+// left queued as interactive
+static void sharp_memory_next_chunk(struct sharp_memory_panel *panel,
+	int chunk_lines)
+{
+	unsigned int y;
+	int n = 0;
 
-static const struct drm_display_mode sharp_memory_ls027b7dh01_mode = {
-	DRM_SIMPLE_MODE(400, 240, 59, 35),
-};
+	bitmap_zero(panel->chunk, panel->height);
 
-DEFINE_DRM_GEM_DMA_FOPS(sharp_memory_fops);
+	spin_lock_irq(&panel->urgent_lock);
+	if (!bitmap_empty(panel->urgent, panel->height)) {
+		bitmap_copy(panel->chunk, panel->urgent, panel->height);
+		bitmap_zero(panel->urgent, panel->height);
+		spin_unlock_irq(&panel->urgent_lock);
+		return;
+	}
+	spin_unlock_irq(&panel->urgent_lock);
 
-static const struct drm_ioctl_desc sharp_memory_ioctls[] = {
-	DRM_IOCTL_DEF_DRV_REDRAW,
-	DRM_IOCTL_DEF_DRV_OV_ADD,
-	DRM_IOCTL_DEF_DRV_OV_REM,
-	DRM_IOCTL_DEF_DRV_OV_SHOW,
-	DRM_IOCTL_DEF_DRV_OV_HIDE,
-	DRM_IOCTL_DEF_DRV_OV_CLEAR
-};
+	// Lines already sent as interactive have nothing new
+	bitmap_and(panel->pending, panel->pending, panel->dirty, panel->height);
+	for_each_set_bit(y, panel->pending, panel->height) {
+		if (n++ == chunk_lines) {
+			break;
+		}
+		__set_bit(y, panel->chunk);
+	}
+	bitmap_andnot(panel->pending, panel->pending, panel->chunk, panel->height);
 
-static const struct drm_driver sharp_memory_driver = {
-	.driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
-	.fops = &sharp_memory_fops,
-	DRM_GEM_DMA_DRIVER_OPS_VMAP,
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
-	.fbdev_probe = drm_fbdev_dma_driver_fbdev_probe,
-#endif
-	.name = "sharp_drm",
-	.desc = "Sharp Memory LCD panel",
-#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 18, 0)
-	.date = "20260401",
-#endif
-	.major = 1,
-	.minor = 5,
+	// Interactive lines marked since are sent with this chunk
+	spin_lock_irq(&panel->urgent_lock);
+	bitmap_andnot(panel->urgent, panel->urgent, panel->chunk, panel->height);
+	spin_unlock_irq(&panel->urgent_lock);
+}
 
-	.ioctls = sharp_memory_ioctls,
-	.num_ioctls = ARRAY_SIZE(sharp_memory_ioctls)
-};
+static void sharp_memory_send_flip_event(struct sharp_memory_panel *panel,
+	struct drm_pending_vblank_event *event)
+{
+	struct drm_crtc *crtc = &panel->pipe.crtc;
+	unsigned long flags;
 
-int drm_probe(struct spi_device *spi)
+	if (!event) {
+		return;
+	}
+
+	spin_lock_irqsave(&crtc->dev->event_lock, flags);
+	drm_crtc_send_vblank_event(crtc, event);
+	spin_unlock_irqrestore(&crtc->dev->event_lock, flags);
+}
+
+// Send pending lines as a clear, then the lines of the new frame that are
+// not blank, when that is fewer bytes. Lines the clear erases without
+// rewriting them must be known to be blank, which is only learned by
+// composing the pending lines. Both writes carry a command byte and a
+// trailer, and the clear command is as long as both, so it is cheaper
+// exactly when more pending lines turn out blank than there are other
+// lines left to rewrite. Rewritten lines show blank until they are sent,
+// so there can only be a few of them. Caller holds `tx_lock`
+static int sharp_memory_flush_clear(struct sharp_memory_panel *panel,
+	u64 *sent, u64 *busy_ns)
 {
-	const struct drm_display_mode *mode;
-	struct device *dev;
-	struct sharp_memory_panel *panel;
-	struct drm_device *drm;
-	int ret;
+	int rc;
+	unsigned int y, pending_lines, blank_lines, kept_lines;
+	int const tagged_line_len = 2 + panel->width / 8;
+	size_t len = 0;
+	ktime_t start;
+	u8 const *src;
+
+	mutex_lock(&panel->flush_lock);
+
+	// Lines that are not being sent must be known
+	bitmap_or(panel->chunk, panel->pending, panel->glass_valid, panel->height);
+	if (!bitmap_full(panel->chunk, panel->height)) {
+		mutex_unlock(&panel->flush_lock);
+		return 0;
+	}
 
-	printk(KERN_INFO "sharp_memory: entering drm_probe\n");
+	// Cheap bound first, blank pending lines can at best equal them all
+	pending_lines = bitmap_weight(panel->pending, panel->height);
+	bitmap_andnot(panel->chunk, panel->glass_valid, panel->blank, panel->height);
+	bitmap_andnot(panel->chunk, panel->chunk, panel->pending, panel->height);
+	kept_lines = bitmap_weight(panel->chunk, panel->height);
+	if (kept_lines >= pending_lines) {
+		mutex_unlock(&panel->flush_lock);
+		return 0;
+	}
 
-	// Get DRM device from SPI struct
-	dev = &spi->dev;
+	(void)sharp_memory_compose_lines(panel, panel->pending);
+	blank_lines = 0;
+	for (src = panel->tx; src < &panel->tx[pending_lines * tagged_line_len];
+	     src += tagged_line_len) {
+		blank_lines += sharp_memory_line_blank(panel, src);
+	}
+	if ((blank_lines <= kept_lines) || ((pending_lines - blank_lines
+	 + kept_lines) > SHARP_MEMORY_CLEAR_REWRITE_LINES)) {
+		mutex_unlock(&panel->flush_lock);
+		return 0;
+	}
 
-	// The SPI device is used to allocate DMA memory
-	if (!dev->coherent_dma_mask) {
-		ret = dma_coerce_mask_and_coherent(dev, DMA_BIT_MASK(32));
-		if (ret) {
-			dev_warn(dev, "Failed to set dma mask %d\n", ret);
-			return ret;
+	// Interactive lines are part of the frame being rewritten
+	bitmap_copy(panel->chunk, panel->pending, panel->height);
+	bitmap_zero(panel->pending, panel->height);
+	spin_lock_irq(&panel->urgent_lock);
+	bitmap_andnot(panel->urgent, panel->urgent, panel->chunk, panel->height);
+	spin_unlock_irq(&panel->urgent_lock);
+	(void)sharp_memory_gather_lines(panel, panel->chunk);
+
+	for (y = 0; y < panel->height; y++) {
+		if (!test_bit(y, panel->blank)) {
+			memcpy(&panel->tx[len], &panel->glass[y * tagged_line_len],
+				tagged_line_len);
+			len += tagged_line_len;
 		}
 	}
+	panel->load.clear_flushes++;
 
-	// Allocate panel storage
-	panel = devm_drm_dev_alloc(dev, &sharp_memory_driver,
-		struct sharp_memory_panel, drm);
-	if (IS_ERR(panel)) {
-		printk(KERN_ERR "sharp_memory: failed to allocate panel\n");
-		return PTR_ERR(panel);
+	mutex_unlock(&panel->flush_lock);
+
+	start = ktime_get();
+	rc = sharp_memory_spi_clear_screen(panel);
+	if (!rc && len) {
+		rc = sharp_memory_spi_write_tagged_lines(panel, panel->tx, len);
 	}
+	*busy_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+	*sent += len / tagged_line_len;
 
-	// Initialize GPIO
-	panel->gpio_disp = devm_gpiod_get(dev, "disp", GPIOD_OUT_HIGH);
-	if (IS_ERR(panel->gpio_disp)) {
-		printk(KERN_INFO "sharp_memory: warning: failed to get GPIO 'disp' from DTS\n");
-		panel->gpio_disp = NULL;
+	return rc;
+}
+
+// Send all dirty lines in one multi-line write, then signal the fences
+// and flip event queued with the damage that write carried. Callers
+// must be inside a DRM device resource area
+static int sharp_memory_flush_now(struct sharp_memory_panel *panel)
+{
+	int rc = 0;
+	size_t len;
+	int chunk_lines;
+	bool interlaced;
+	ktime_t start;
+	u64 sent = 0, busy_ns = 0;
+	u64 seq;
+	int const tagged_line_len = 2 + panel->width / 8;
+	struct drm_pending_vblank_event *event;
+	LIST_HEAD(fences);
+
+	mutex_lock(&panel->tx_lock);
+
+	// Lines stay dirty while parked, resume sends everything
+	if (READ_ONCE(panel->parked)) {
+		mutex_unlock(&panel->tx_lock);
+		return 0;
 	}
 
-	panel->gpio_vcom = devm_gpiod_get(dev, "vcom", GPIOD_OUT_LOW);
-	if (IS_ERR(panel->gpio_vcom)) {
-		printk(KERN_INFO "sharp_memory: warning: failed to get GPIO 'vcom' from DTS\n");
-		panel->gpio_vcom = NULL;
+	// The QEMU serial writer is better off with whole frames
+	chunk_lines = (panel->qemu_file) ? panel->height : SHARP_MEMORY_CHUNK_LINES;
+
+	// Fences and the flip event cover the lines dirty now. Fences promise
+	// the lines are on the panel, so flushes carrying them are whole
+	mutex_lock(&panel->flush_lock);
+	bitmap_copy(panel->pending, panel->dirty, panel->height);
+	seq = ++panel->flush_seq;
+	list_splice_tail_init(&panel->fences, &fences);
+	event = panel->flip_event;
+	panel->flip_event = NULL;
+	interlaced = panel->load.interlaced && list_empty(&fences);
+	if (interlaced) {
+		sharp_memory_select_field(panel);
 	}
+	mutex_unlock(&panel->flush_lock);
 
-	panel->gpio_cs = devm_gpiod_get(dev, "cs", GPIOD_OUT_HIGH);
-	if (IS_ERR(panel->gpio_cs)) {
-		printk(KERN_INFO "sharp_memory: warning: failed to get GPIO 'cs' from DTS\n");
-		panel->gpio_cs = NULL;
+	// Blank or mostly blank frames, such as a cleared terminal
+	if (!interlaced) {
+		rc = sharp_memory_flush_clear(panel, &sent, &busy_ns);
 	}
 
-	// Initalize DRM mode
-	drm = &panel->drm;
-	ret = drmm_mode_config_init(drm);
-	if (ret) {
-		return ret;
+	// New damage can be stored while each chunk is sent. Chunks are
+	// gathered right before they are sent, so a line sent early as
+	// interactive is never followed by an older copy
+	while (!rc) {
+		mutex_lock(&panel->flush_lock);
+		sharp_memory_next_chunk(panel, chunk_lines);
+		len = sharp_memory_gather_lines(panel, panel->chunk);
+		mutex_unlock(&panel->flush_lock);
+
+		if (len) {
+			start = ktime_get();
+			rc = sharp_memory_spi_write_tagged_lines(panel, panel->tx, len);
+			busy_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+			sent += len / tagged_line_len;
+		} else {
+			break;
+		}
 	}
-	drm->mode_config.funcs = &sharp_memory_mode_config_funcs;
 
-	// Initialize panel contents
-	panel->spi = spi;
-	panel->fb = NULL;
-	mode = &sharp_memory_ls027b7dh01_mode;
-	panel->mode = mode;
-	panel->width = mode->hdisplay;
-	panel->height = mode->vdisplay;
+	mutex_lock(&panel->flush_lock);
 
-	// Allocate reused heap buffers suitable for SPI source
-	panel->buf = devm_kzalloc(dev, panel->width * panel->height, GFP_KERNEL);
-	panel->spi_3_xfers = devm_kzalloc(dev, sizeof(struct spi_transfer) * 3, GFP_KERNEL);
-	panel->cmd_buf = devm_kzalloc(dev, 1, GFP_KERNEL);
-	panel->trailer_buf = devm_kzalloc(dev, 1, GFP_KERNEL);
+	// Lines may or may not have reached the panel
+	if (rc) {
+		bitmap_zero(panel->glass_valid, panel->height);
+	}
 
-	// DRM mode settings
-	drm->mode_config.min_width = mode->hdisplay;
-	drm->mode_config.max_width = mode->hdisplay;
-	drm->mode_config.min_height = mode->vdisplay;
-	drm->mode_config.max_height = mode->vdisplay;
+	panel->load.sent += sent;
+	panel->load.busy_ns += busy_ns;
+	sharp_memory_update_load(panel);
+
+	// Lines of the other fields are sent next, even without new damage.
+	// Writeback waits for the last field, so it captures a whole frame.
+	// Flushes started before the job was armed may miss its commit
+	if (interlaced && !rc && !bitmap_empty(panel->dirty, panel->height)) {
+		queue_work(panel->flush_wq, &panel->flush_work);
+	} else if (panel->wb_seq && (seq >= panel->wb_seq)) {
+		sharp_memory_complete_writeback(panel, rc);
+	}
+	mutex_unlock(&panel->flush_lock);
 
-	// Configure DRM connector
-	ret = drm_connector_init(drm, &panel->connector, &sharp_memory_connector_funcs,
-		DRM_MODE_CONNECTOR_SPI);
-	if (ret) {
-		return ret;
+	mutex_unlock(&panel->tx_lock);
+
+	sharp_memory_signal_fences(&fences, rc);
+	sharp_memory_send_flip_event(panel, event);
+
+	return rc;
+}
+
+static void sharp_memory_flush_work(struct work_struct *work)
+{
+	struct sharp_memory_panel *panel = container_of(work,
+		struct sharp_memory_panel, flush_work);
+	int drm_idx;
+	struct drm_pending_vblank_event *event;
+	LIST_HEAD(fences);
+
+	if (!drm_dev_enter(&panel->drm, &drm_idx)) {
+
+		// Device is gone, fail anything still waiting on the bus
+		mutex_lock(&panel->flush_lock);
+		list_splice_tail_init(&panel->fences, &fences);
+		event = panel->flip_event;
+		panel->flip_event = NULL;
+		sharp_memory_complete_writeback(panel, -ENODEV);
+		mutex_unlock(&panel->flush_lock);
+		sharp_memory_signal_fences(&fences, -ENODEV);
+		sharp_memory_send_flip_event(panel, event);
+		return;
 	}
-	drm_connector_helper_add(&panel->connector, &sharp_memory_connector_hfuncs);
 
-	// Initialize DRM pipe
-	ret = drm_simple_display_pipe_init(drm, &panel->pipe, &sharp_memory_pipe_funcs,
-		sharp_memory_formats, ARRAY_SIZE(sharp_memory_formats),
-		NULL, &panel->connector);
-	if (ret) {
-		return ret;
+	sharp_memory_flush_now(panel);
+
+	drm_dev_exit(drm_idx);
+}
+
+// Send interactive lines on their own. This runs on the high priority
+// system queue, so it only waits for the chunk in progress, not for
+// flushes queued behind it
+static void sharp_memory_urgent_work(struct work_struct *work)
+{
+	struct sharp_memory_panel *panel = container_of(work,
+		struct sharp_memory_panel, urgent_work);
+	size_t len = 0;
+	int drm_idx;
+
+	if (!drm_dev_enter(&panel->drm, &drm_idx)) {
+		return;
 	}
 
-	// Enable damaged screen area clips
-	drm_plane_enable_fb_damage_clips(&panel->pipe.plane);
+	mutex_lock(&panel->tx_lock);
+	mutex_lock(&panel->flush_lock);
 
-	drm_mode_config_reset(drm);
+	spin_lock_irq(&panel->urgent_lock);
+	bitmap_copy(panel->chunk, panel->urgent, panel->height);
+	bitmap_zero(panel->urgent, panel->height);
+	spin_unlock_irq(&panel->urgent_lock);
 
-	printk(KERN_INFO "sharp_memory: registering DRM device\n");
-	ret = drm_dev_register(drm, 0);
-	if (ret) {
-		return ret;
+	// Resume sends every line, and the QEMU serial line is only written
+	// by the flush worker
+	if (READ_ONCE(panel->parked) || panel->qemu_file) {
+		bitmap_or(panel->dirty, panel->dirty, panel->chunk, panel->height);
+	} else {
+		len = sharp_memory_gather_lines(panel, panel->chunk);
 	}
 
-	// fbdev setup
-	spi_set_drvdata(spi, drm);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
-	drm_client_setup(drm, NULL);
+	mutex_unlock(&panel->flush_lock);
+
+	if (len) {
+		(void)sharp_memory_spi_write_tagged_lines(panel, panel->tx, len);
+	} else if (panel->qemu_file) {
+		queue_work(panel->flush_wq, &panel->flush_work);
+	}
+
+	mutex_unlock(&panel->tx_lock);
+
+	drm_dev_exit(drm_idx);
+}
+
+// Send dirty lines. SPI transfers are made by the caller. The QEMU serial
+// line is much slower, so only the flush worker writes to it: damage
+// stored while a frame is being written is coalesced into the next one,
+// and lines overwritten in the meantime are never sent. Callers must be
+// inside a DRM device resource area
+static int sharp_memory_flush(struct sharp_memory_panel *panel)
+{
+	if (panel->qemu_file) {
+		queue_work(panel->flush_wq, &panel->flush_work);
+		return 0;
+	}
+
+	return sharp_memory_flush_now(panel);
+}
+
+// Settings changed outside of an atomic commit
+static void sharp_memory_params_work(struct work_struct *work)
+{
+	struct sharp_memory_panel *panel = container_of(work,
+		struct sharp_memory_panel, params_work);
+	int drm_idx;
+	bool changed;
+
+	if (!drm_dev_enter(&panel->drm, &drm_idx)) {
+		return;
+	}
+
+	mutex_lock(&panel->flush_lock);
+	changed = sharp_memory_apply_profile(panel);
+	mutex_unlock(&panel->flush_lock);
+
+	if (changed) {
+		sharp_memory_flush(panel);
+	}
+
+	drm_dev_exit(drm_idx);
+}
+
+// Read the framebuffer to get grayscale representation, then convert to mono
+// with line number and trailer tags suitable for multi-line write
+// `clip` is in framebuffer coordinates, output lines are panel lines
+// Output is stored in `buf`, which must be at least W*H bytes
+static int sharp_memory_clip_mono_tagged(struct sharp_memory_panel* panel, size_t* result_len,
+	u8* buf, struct drm_framebuffer *fb, struct drm_rect const* clip)
+{
+	int rc;
+	bool cache;
+	u8 *gray;
+	struct sharp_memory_profile profile;
+	struct iosys_map dst, vmap[DRM_FORMAT_MAX_PLANES];
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+	struct drm_format_conv_state fmtcnv_state = DRM_FORMAT_CONV_STATE_INIT;
+#endif
+
+	// Start CPU access area
+	rc = sharp_memory_fb_begin_access(panel, fb, vmap, DMA_FROM_DEVICE);
+	if (rc) {
+		return rc;
+	}
+
+	// Gray rows go straight into the cache when they fit, so that they can
+	// be re-thresholded later. Otherwise they are converted in `buf`
+	cache = (fb->width == panel->width / panel->scale)
+		&& (clip->x1 == 0) && (clip->x2 == fb->width)
+		&& (clip->y2 <= panel->height / panel->scale);
+	gray = (cache) ? &panel->gray[clip->y1 * fb->width] : buf;
+
+	// Initialize destination (gray)
+	iosys_map_set_vaddr(&dst, gray);
+	// Copy `clip` into `gray` and convert to 8-bit grayscale
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+	drm_fb_xrgb8888_to_gray8(&dst, NULL, vmap, fb, clip, &fmtcnv_state);
 #else
-	drm_fbdev_generic_setup(drm, 0);
+	drm_fb_xrgb8888_to_gray8(&dst, NULL, vmap, fb, clip);
 #endif
 
-	printk(KERN_INFO "sharp_memory: successful probe\n");
+	// End CPU access area
+	sharp_memory_fb_end_access(panel, fb, vmap, DMA_FROM_DEVICE);
 
+	if (cache) {
+		bitmap_set(panel->gray_valid, clip->y1, clip->y2 - clip->y1);
+	} else {
+		sharp_memory_invalidate_gray(panel, clip->y1 * panel->scale,
+			clip->y2 * panel->scale);
+	}
+
+	// Convert from 8-bit grayscale to mono. Caller holds `flush_lock`, so
+	// settings can't change partway through
+	sharp_memory_get_profile(panel, &profile);
+	*result_len = sharp_memory_gray8_convert(panel, buf, gray,
+		(clip->x2 - clip->x1), clip->y1, clip->y2, &profile);
+
+	// Success
 	return 0;
 }
 
-void drm_remove(struct spi_device *spi)
+// Convert dirty framebuffer rows into the mono shadow, the flush worker
+// sends them
+static int sharp_memory_fb_dirty(struct drm_framebuffer *fb,
+	struct drm_rect const* dirty_rect)
+{
+	int rc;
+	struct drm_rect clip;
+	struct sharp_memory_panel *panel;
+	int drm_idx;
+	size_t buf_len;
+	bool gray_valid;
+
+	// Clip dirty region rows
+	clip.x1 = 0;
+	clip.x2 = fb->width;
+	clip.y1 = dirty_rect->y1;
+	clip.y2 = dirty_rect->y2;
+
+	// Get panel info from DRM struct
+	panel = drm_to_panel(fb->dev);
+
+	// Enter DRM device resource area
+	if (!drm_dev_enter(fb->dev, &drm_idx)) {
+		return -ENODEV;
+	}
+
+	mutex_lock(&panel->flush_lock);
+
+	// Convert `clip` from framebuffer to mono with line number tags
+	rc = sharp_memory_clip_mono_tagged(panel, &buf_len, panel->buf, fb, &clip);
+	if (!rc) {
+		sharp_memory_store_lines(panel, panel->buf,
+			clip.y1 * panel->scale, clip.y2 * panel->scale);
+	}
+
+	// Gray rows are only available if they went through the cache
+	if (!rc && (damage_trace_mode() != SHARP_MEMORY_TRACE_OFF)) {
+		gray_valid = (find_next_zero_bit(panel->gray_valid, clip.y2, clip.y1)
+			>= clip.y2);
+		damage_trace_record(dirty_rect, fb->width, fb->height,
+			(gray_valid) ? &panel->gray[clip.y1 * fb->width] : NULL);
+	}
+
+	mutex_unlock(&panel->flush_lock);
+
+	// Exit DRM device resource area
+	drm_dev_exit(drm_idx);
+
+	return rc;
+}
+
+
+// Convert rows [y1, y2) of 1bpp source, leftmost pixel in the MSB, to
+// tagged mono lines. Output is stored in `buf`
+static size_t sharp_memory_mono_to_mono_tagged(u8 *buf, u8 const *src,
+	size_t pitch, int width, int y1, int y2)
+{
+	int line;
+	int const line_len = width / 8;
+	int const tagged_line_len = 2 + line_len;
+	u8 *dst;
+
+	for (line = y1; line < y2; line++) {
+		dst = &buf[(line - y1) * tagged_line_len];
+
+		dst[0] = sharp_memory_reverse_byte((u8)(line + 1)); // Indexed from 1
+		memcpy(&dst[1], &src[line * pitch], line_len);
+		dst[tagged_line_len - 1] = 0;
+	}
+
+	return (y2 - y1) * tagged_line_len;
+}
+
+static int power_on(struct sharp_memory_panel *panel)
+{
+	int rc = 0;
+	s64 elapsed_us;
+
+	printk(KERN_INFO "sharp_memory: powering on\n");
+
+	// Power up sequence
+	if (panel->gpio_disp) {
+		gpiod_set_value(panel->gpio_disp, 1);
+	}
+	if (panel->gpio_vcom) {
+		gpiod_set_value(panel->gpio_vcom, 0);
+	}
+	set_gpio_cs(panel, 1);
+
+	if (panel->handoff) {
+		panel->handoff = false;
+		elapsed_us = ktime_us_delta(ktime_get(), panel->probe_time);
+		if (elapsed_us < 5000) {
+			usleep_range(5000 - elapsed_us, 10000 - elapsed_us);
+		}
+		printk(KERN_INFO "sharp_memory: keeping panel contents\n");
+
+	// Clear display
+	} else {
+		usleep_range(5000, 10000);
+		rc = sharp_memory_spi_clear_screen(panel);
+	}
+
+	if (rc) {
+		if (panel->gpio_disp) {
+			gpiod_set_value(panel->gpio_disp, 0); // Power down display, VCOM is not running
+		}
+		return rc;
+	}
+
+	// Initialize and schedule the VCOM timer
+	INIT_WORK(&panel->vcom_work, sharp_memory_vcom_work);
+	timer_setup(&panel->vcom_timer, vcom_timer_callback, 0);
+	mod_timer(&panel->vcom_timer, jiffies + msecs_to_jiffies(500));
+
+	return 0;
+}
+
+static void sharp_memory_vcom_stop(struct sharp_memory_panel *panel)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	timer_delete_sync(&panel->vcom_timer);
+#else
+	del_timer_sync(&panel->vcom_timer);
+#endif
+	cancel_work_sync(&panel->vcom_work);
+}
+
+static void power_off(struct sharp_memory_panel *panel)
+{
+	printk(KERN_INFO "sharp_memory: powering off\n");
+
+	// Cancel the timer
+	sharp_memory_vcom_stop(panel);
+
+	// Clear display if auto clear is set
+	if (g_param_auto_clear) {
+		(void)sharp_memory_spi_clear_screen(panel);
+	}
+
+	/* Turn off power and all signals */
+	if (panel->gpio_disp) {
+		gpiod_set_value(panel->gpio_disp, 0);
+	}
+	if (panel->gpio_vcom) {
+		gpiod_set_value(panel->gpio_vcom, 0);
+	}
+}
+
+// Power is reference counted between the DRM pipe and the mono fbdev,
+// which can both drive the panel
+static int sharp_memory_power_get(struct sharp_memory_panel *panel)
+{
+	int rc = 0;
+
+	// Runtime PM follows power users, the SPI device stays active while
+	// the panel is in use. Resume callbacks take `power_lock`
+	if (panel->spi) {
+		rc = pm_runtime_resume_and_get(&panel->spi->dev);
+		if (rc) {
+			return rc;
+		}
+	}
+
+	mutex_lock(&panel->power_lock);
+	if (panel->power_users == 0) {
+		rc = power_on(panel);
+	}
+	if (!rc) {
+		panel->power_users++;
+	}
+	mutex_unlock(&panel->power_lock);
+
+	if (rc && panel->spi) {
+		pm_runtime_put(&panel->spi->dev);
+	}
+
+	return rc;
+}
+
+static void sharp_memory_power_put(struct sharp_memory_panel *panel)
+{
+	bool released = false;
+
+	mutex_lock(&panel->power_lock);
+	if (panel->power_users > 0) {
+		panel->power_users--;
+		if (panel->power_users == 0) {
+			power_off(panel);
+		}
+		released = true;
+	}
+	mutex_unlock(&panel->power_lock);
+
+	if (released && panel->spi) {
+		pm_runtime_put(&panel->spi->dev);
+	}
+}
+
+// Park VCOM and DISP without clearing. The panel keeps its contents
+// while powered, and the shadow holds them in case it wasn't
+static int sharp_memory_park(struct sharp_memory_panel *panel)
+{
+	mutex_lock(&panel->power_lock);
+
+	if ((panel->power_users > 0) && !panel->parked) {
+		printk(KERN_INFO "sharp_memory: parking\n");
+
+		// Hold back transfers, then wait out the one in progress
+		WRITE_ONCE(panel->parked, true);
+		mutex_lock(&panel->tx_lock);
+		mutex_unlock(&panel->tx_lock);
+
+		sharp_memory_vcom_stop(panel);
+		if (panel->gpio_disp) {
+			gpiod_set_value(panel->gpio_disp, 0);
+		}
+		if (panel->gpio_vcom) {
+			gpiod_set_value(panel->gpio_vcom, 0);
+		}
+	}
+
+	mutex_unlock(&panel->power_lock);
+
+	return 0;
+}
+
+// Retransmit the last frame from the mono shadow, then turn the display
+// back on. There is no clear or power-up delay, and the framebuffer is
+// not read
+static int sharp_memory_unpark(struct sharp_memory_panel *panel)
+{
+	int rc = 0;
+	int drm_idx;
+
+	mutex_lock(&panel->power_lock);
+
+	if (panel->parked) {
+		printk(KERN_INFO "sharp_memory: unparking\n");
+
+		WRITE_ONCE(panel->parked, false);
+		set_gpio_cs(panel, 1);
+
+		if (drm_dev_enter(&panel->drm, &drm_idx)) {
+			mutex_lock(&panel->flush_lock);
+			sharp_memory_mark_shadow(panel);
+			mutex_unlock(&panel->flush_lock);
+
+			rc = sharp_memory_flush_now(panel);
+
+			drm_dev_exit(drm_idx);
+		}
+
+		if (panel->gpio_disp) {
+			gpiod_set_value(panel->gpio_disp, 1);
+		}
+		mod_timer(&panel->vcom_timer, jiffies + msecs_to_jiffies(500));
+	}
+
+	mutex_unlock(&panel->power_lock);
+
+	return rc;
+}
+
+static void sharp_memory_pipe_enable(struct drm_simple_display_pipe *pipe,
+	struct drm_crtc_state *crtc_state, struct drm_plane_state *plane_state)
+{
+	struct sharp_memory_panel *panel;
+	int drm_idx;
+
+	printk(KERN_INFO "sharp_memory: entering sharp_memory_pipe_enable\n");
+
+	// Get panel struct
+	panel = drm_to_panel(pipe->crtc.dev);
+
+	// Enter DRM resource area
+	if (!drm_dev_enter(pipe->crtc.dev, &drm_idx)) {
+		return;
+	}
+
+	drm_crtc_vblank_on(&pipe->crtc);
+
+	if (sharp_memory_power_get(panel)) {
+		goto out_exit;
+	}
+	panel->pipe_powered = true;
+
+	printk(KERN_INFO "sharp_memory: completed sharp_memory_pipe_enable\n");
+
+out_exit:
+	drm_dev_exit(drm_idx);
+}
+
+static void sharp_memory_pipe_disable(struct drm_simple_display_pipe *pipe)
+{
+	struct sharp_memory_panel *panel;
+
+	printk(KERN_INFO "sharp_memory: sharp_memory_pipe_disable\n");
+
+	// Get panel struct
+	panel = drm_to_panel(pipe->crtc.dev);
+
+	drm_crtc_vblank_off(&pipe->crtc);
+
+	// No more flushes until the next enable, capture what is on the glass
+	mutex_lock(&panel->flush_lock);
+	sharp_memory_complete_writeback(panel, 0);
+	mutex_unlock(&panel->flush_lock);
+
+	// Enable may have failed to power up
+	if (panel->pipe_powered) {
+		panel->pipe_powered = false;
+		sharp_memory_power_put(panel);
+	}
+}
+
+static void sharp_memory_pipe_update(struct drm_simple_display_pipe *pipe,
+				struct drm_plane_state *old_state)
+{
+	struct drm_plane_state *state = pipe->plane.state;
+	struct drm_crtc *crtc = &pipe->crtc;
+	struct sharp_memory_panel *panel = drm_to_panel(crtc->dev);
+	struct drm_pending_vblank_event *event, *prev;
+	struct sharp_memory_connector_state *conn_state;
+	struct drm_rect rect;
+	bool unchanged;
+
+	spin_lock_irq(&crtc->dev->event_lock);
+	event = crtc->state->event;
+	crtc->state->event = NULL;
+	spin_unlock_irq(&crtc->dev->event_lock);
+
+	if (!crtc->state->active) {
+		sharp_memory_send_flip_event(panel, event);
+		return;
+	}
+
+	// Connector properties apply with this commit. Changed settings are
+	// applied to the cached rows first, then damage is converted on top
+	conn_state = to_sharp_memory_connector_state(panel->connector.state);
+	mutex_lock(&panel->flush_lock);
+	panel->override = conn_state->profile;
+	(void)sharp_memory_apply_profile(panel);
+	mutex_unlock(&panel->flush_lock);
+
+	// Commits on the CRTC always include the primary, see
+	// `sharp_memory_add_primary`. Without new contents or damage clips
+	// its lines are already in the shadow
+	unchanged = (state->fb == old_state->fb)
+		&& drm_rect_equals(&state->src, &old_state->src)
+		&& !drm_plane_get_damage_clips_count(state)
+		&& !drm_atomic_crtc_needs_modeset(crtc->state);
+
+	if (!unchanged && drm_atomic_helper_damage_merged(old_state, state, &rect)) {
+		sharp_memory_fb_dirty(state->fb, &rect);
+	}
+
+	// Flip completes when the flush carrying this damage is on the panel.
+	// The flush is queued once all planes are updated
+	mutex_lock(&panel->flush_lock);
+	prev = panel->flip_event;
+	panel->flip_event = event;
+	mutex_unlock(&panel->flush_lock);
+
+	sharp_memory_send_flip_event(panel, prev);
+}
+
+static enum hrtimer_restart sharp_memory_vblank_timer_callback(
+	struct hrtimer *timer)
+{
+	struct sharp_memory_panel *panel = container_of(timer,
+		struct sharp_memory_panel, vblank_timer);
+
+	drm_crtc_handle_vblank(&panel->pipe.crtc);
+	hrtimer_forward_now(timer, panel->frame_period);
+
+	return HRTIMER_RESTART;
+}
+
+static int sharp_memory_pipe_enable_vblank(struct drm_simple_display_pipe *pipe)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(pipe->crtc.dev);
+
+	hrtimer_start(&panel->vblank_timer, panel->frame_period,
+		HRTIMER_MODE_REL);
+
+	return 0;
+}
+
+static void sharp_memory_pipe_disable_vblank(struct drm_simple_display_pipe *pipe)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(pipe->crtc.dev);
+
+	hrtimer_cancel(&panel->vblank_timer);
+}
+
+// Same as `drm_atomic_helper_commit_tail`, but the panel is powered before
+// planes are drawn, all planes are sent in one flush, and the commit waits
+// for flip events, which are sent once the flush reaches the panel,
+// instead of the next vblank
+static void sharp_memory_atomic_commit_tail(struct drm_atomic_state *state)
+{
+	struct drm_device *dev = state->dev;
+	struct sharp_memory_panel *panel = drm_to_panel(dev);
+
+	drm_atomic_helper_commit_modeset_disables(dev, state);
+	drm_atomic_helper_commit_modeset_enables(dev, state);
+	drm_atomic_helper_commit_planes(dev, state, 0);
+
+	// A writeback job queued by this commit now waits for the next
+	// flush, which is the first to carry the updated planes
+	mutex_lock(&panel->flush_lock);
+	if (panel->wb_fb && !panel->wb_seq) {
+		panel->wb_seq = panel->flush_seq + 1;
+	}
+	mutex_unlock(&panel->flush_lock);
+
+	if (panel->pipe.crtc.state->active) {
+		queue_work(panel->flush_wq, &panel->flush_work);
+	}
+
+	drm_atomic_helper_fake_vblank(state);
+	drm_atomic_helper_commit_hw_done(state);
+	drm_atomic_helper_wait_for_flip_done(dev, state);
+	drm_atomic_helper_cleanup_planes(dev, state);
+}
+
+static const struct drm_simple_display_pipe_funcs sharp_memory_pipe_funcs = {
+	.enable = sharp_memory_pipe_enable,
+	.disable = sharp_memory_pipe_disable,
+	.update = sharp_memory_pipe_update,
+	.enable_vblank = sharp_memory_pipe_enable_vblank,
+	.disable_vblank = sharp_memory_pipe_disable_vblank,
+	// .prepare_fb and .cleanup_fb are handled automatically when not set
+};
+
+static int sharp_memory_connector_get_modes(struct drm_connector *connector)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(connector->dev);
+
+	return drm_connector_helper_get_modes_fixed(connector, panel->mode);
+}
+
+
+// https://github.com/torvalds/linux/commit/4cd24d4b1a9548f42cdb7f449edc6f869a8ae730
+// Redraw requests read the last primary-capable framebuffer, overlay
+// plane framebuffers are not kept
+static struct drm_framebuffer* store_fb(struct drm_device *dev,
+	struct drm_framebuffer *fb)
+{
+	if (!IS_ERR(fb) && (fb->format->format == DRM_FORMAT_XRGB8888)) {
+		drm_to_panel(dev)->fb = fb;
+	}
+
+	return fb;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
+static struct drm_framebuffer* create_and_store_fb(struct drm_device *dev,
+	struct drm_file *file, const struct drm_format_info *info,
+	const struct drm_mode_fb_cmd2 *mode_cmd)
+{
+	return store_fb(dev,
+		drm_gem_fb_create_with_dirty(dev, file, info, mode_cmd));
+}
+#else
+static struct drm_framebuffer* create_and_store_fb(struct drm_device *dev,
+	struct drm_file *file, const struct drm_mode_fb_cmd2 *mode_cmd)
+{
+	return store_fb(dev, drm_gem_fb_create_with_dirty(dev, file, mode_cmd));
+}
+#endif
+
+static void sharp_memory_connector_reset(struct drm_connector *connector)
+{
+	struct sharp_memory_connector_state *state;
+
+	if (connector->state) {
+		__drm_atomic_helper_connector_destroy_state(connector->state);
+		kfree(to_sharp_memory_connector_state(connector->state));
+		connector->state = NULL;
+	}
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state) {
+		return;
+	}
+
+	// Follow module parameters until a client sets the properties
+	state->profile.cutoff = -1;
+	state->profile.invert = -1;
+	state->profile.dither = -1;
+	__drm_atomic_helper_connector_reset(connector, &state->base);
+}
+
+static struct drm_connector_state *sharp_memory_connector_duplicate_state(
+	struct drm_connector *connector)
+{
+	struct sharp_memory_connector_state *state;
+
+	if (WARN_ON(!connector->state)) {
+		return NULL;
+	}
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state) {
+		return NULL;
+	}
+
+	__drm_atomic_helper_connector_duplicate_state(connector, &state->base);
+	state->profile = to_sharp_memory_connector_state(connector->state)->profile;
+
+	return &state->base;
+}
+
+static void sharp_memory_connector_destroy_state(struct drm_connector *connector,
+	struct drm_connector_state *state)
+{
+	__drm_atomic_helper_connector_destroy_state(state);
+	kfree(to_sharp_memory_connector_state(state));
+}
+
+// Invert and dither enums are stored offset by one so that "Default" is -1
+static int sharp_memory_connector_atomic_set_property(
+	struct drm_connector *connector, struct drm_connector_state *state,
+	struct drm_property *property, uint64_t val)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(connector->dev);
+	struct sharp_memory_profile *profile
+		= &to_sharp_memory_connector_state(state)->profile;
+
+	if (property == panel->cutoff_prop) {
+		profile->cutoff = U642I64(val);
+	} else if (property == panel->invert_prop) {
+		profile->invert = (int)val - 1;
+	} else if (property == panel->dither_prop) {
+		profile->dither = (int)val - 1;
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sharp_memory_connector_atomic_get_property(
+	struct drm_connector *connector, const struct drm_connector_state *state,
+	struct drm_property *property, uint64_t *val)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(connector->dev);
+	struct sharp_memory_profile const *profile = &container_of(state,
+		struct sharp_memory_connector_state, base)->profile;
+
+	if (property == panel->cutoff_prop) {
+		*val = I642U64(profile->cutoff);
+	} else if (property == panel->invert_prop) {
+		*val = profile->invert + 1;
+	} else if (property == panel->dither_prop) {
+		*val = profile->dither + 1;
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+// Property changes need the plane in the commit so that the update
+// callback applies them
+static int sharp_memory_connector_atomic_check(struct drm_connector *connector,
+	struct drm_atomic_state *state)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(connector->dev);
+	struct drm_connector_state *old_state, *new_state;
+	struct drm_crtc_state *crtc_state;
+	struct drm_plane_state *plane_state;
+
+	old_state = drm_atomic_get_old_connector_state(state, connector);
+	new_state = drm_atomic_get_new_connector_state(state, connector);
+
+	if (!new_state->crtc || !memcmp(
+		&to_sharp_memory_connector_state(old_state)->profile,
+		&to_sharp_memory_connector_state(new_state)->profile,
+		sizeof(struct sharp_memory_profile))) {
+		return 0;
+	}
+
+	crtc_state = drm_atomic_get_crtc_state(state, new_state->crtc);
+	if (IS_ERR(crtc_state)) {
+		return PTR_ERR(crtc_state);
+	}
+
+	plane_state = drm_atomic_get_plane_state(state, &panel->pipe.plane);
+
+	return PTR_ERR_OR_ZERO(plane_state);
+}
+
+static const struct drm_connector_helper_funcs sharp_memory_connector_hfuncs = {
+	.get_modes = sharp_memory_connector_get_modes,
+	.atomic_check = sharp_memory_connector_atomic_check,
+};
+
+static const struct drm_connector_funcs sharp_memory_connector_funcs = {
+	.reset = sharp_memory_connector_reset,
+	.fill_modes = drm_helper_probe_single_connector_modes,
+	.destroy = drm_connector_cleanup,
+	.atomic_duplicate_state = sharp_memory_connector_duplicate_state,
+	.atomic_destroy_state = sharp_memory_connector_destroy_state,
+	.atomic_set_property = sharp_memory_connector_atomic_set_property,
+	.atomic_get_property = sharp_memory_connector_atomic_get_property,
+};
+
+static const struct drm_prop_enum_list sharp_memory_invert_names[] = {
+	{ 0, "Default" },
+	{ 1, "Off" },
+	{ 2, "On" },
+};
+
+static const struct drm_prop_enum_list sharp_memory_dither_names[] = {
+	{ 0, "Default" },
+	{ 1, "None" },
+	{ 2, "Ordered" },
+};
+
+static int sharp_memory_connector_init_properties(struct sharp_memory_panel *panel)
+{
+	struct drm_device *drm = &panel->drm;
+	struct drm_mode_object *obj = &panel->connector.base;
+
+	panel->cutoff_prop = drm_property_create_signed_range(drm, 0,
+		"SHARP_MONO_CUTOFF", -1, 255);
+	panel->invert_prop = drm_property_create_enum(drm, 0,
+		"SHARP_MONO_INVERT", sharp_memory_invert_names,
+		ARRAY_SIZE(sharp_memory_invert_names));
+	panel->dither_prop = drm_property_create_enum(drm, 0,
+		"SHARP_MONO_DITHER", sharp_memory_dither_names,
+		ARRAY_SIZE(sharp_memory_dither_names));
+	if (!panel->cutoff_prop || !panel->invert_prop || !panel->dither_prop) {
+		return -ENOMEM;
+	}
+
+	drm_object_attach_property(obj, panel->cutoff_prop, I642U64(-1));
+	drm_object_attach_property(obj, panel->invert_prop, 0);
+	drm_object_attach_property(obj, panel->dither_prop, 0);
+
+	return 0;
+}
+
+static void sharp_memory_plane_reset(struct drm_plane *plane)
+{
+	struct sharp_memory_plane_state *state;
+
+	if (plane->state) {
+		__drm_atomic_helper_plane_destroy_state(plane->state);
+		kfree(to_sharp_memory_plane_state(plane->state));
+		plane->state = NULL;
+	}
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state) {
+		return;
+	}
+
+	state->key = -1;
+	__drm_atomic_helper_plane_reset(plane, &state->base);
+}
+
+static struct drm_plane_state *sharp_memory_plane_duplicate_state(
+	struct drm_plane *plane)
+{
+	struct sharp_memory_plane_state *state;
+
+	if (WARN_ON(!plane->state)) {
+		return NULL;
+	}
+
+	state = kzalloc(sizeof(*state), GFP_KERNEL);
+	if (!state) {
+		return NULL;
+	}
+
+	__drm_atomic_helper_plane_duplicate_state(plane, &state->base);
+	state->key = to_sharp_memory_plane_state(plane->state)->key;
+
+	return &state->base;
+}
+
+static void sharp_memory_plane_destroy_state(struct drm_plane *plane,
+	struct drm_plane_state *state)
+{
+	__drm_atomic_helper_plane_destroy_state(state);
+	kfree(to_sharp_memory_plane_state(state));
+}
+
+static int sharp_memory_plane_atomic_set_property(struct drm_plane *plane,
+	struct drm_plane_state *state, struct drm_property *property,
+	uint64_t val)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(plane->dev);
+
+	if (property == panel->key_prop) {
+		to_sharp_memory_plane_state(state)->key = U642I64(val);
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int sharp_memory_plane_atomic_get_property(struct drm_plane *plane,
+	const struct drm_plane_state *state, struct drm_property *property,
+	uint64_t *val)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(plane->dev);
+
+	if (property == panel->key_prop) {
+		*val = I642U64(container_of(state,
+			struct sharp_memory_plane_state, base)->key);
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+// Only the pipe update sends the CRTC event of a commit, so the primary
+// joins every commit on the CRTC, also when it is unchanged. Otherwise
+// the commit tail waits for a flip that never completes
+static int sharp_memory_add_primary(struct drm_atomic_state *state)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(state->dev);
+	struct drm_plane_state *plane_state;
+
+	if (!drm_atomic_get_new_crtc_state(state, &panel->pipe.crtc)) {
+		return 0;
+	}
+
+	plane_state = drm_atomic_get_plane_state(state, &panel->pipe.plane);
+
+	return PTR_ERR_OR_ZERO(plane_state);
+}
+
+// Overlay planes are positioned freely but not scaled. The visible part
+// is clipped to the CRTC
+static int sharp_memory_plane_atomic_check(struct drm_plane *plane,
+	struct drm_atomic_state *state)
+{
+	struct drm_plane_state *plane_state;
+	struct drm_crtc_state *crtc_state = NULL;
+	int rc;
+
+	rc = sharp_memory_add_primary(state);
+	if (rc) {
+		return rc;
+	}
+
+	plane_state = drm_atomic_get_new_plane_state(state, plane);
+	if (plane_state->crtc) {
+		crtc_state = drm_atomic_get_new_crtc_state(state, plane_state->crtc);
+	}
+
+	return drm_atomic_helper_check_plane_state(plane_state, crtc_state,
+		DRM_PLANE_NO_SCALING, DRM_PLANE_NO_SCALING, true, false);
+}
+
+// Copy framebuffer rows [y1, y2) of the plane source into the plane image,
+// repeating pixels to panel resolution, and mark the lines they cover.
+// Caller holds `flush_lock`
+static int sharp_memory_plane_copy(struct sharp_memory_panel *panel,
+	struct sharp_memory_plane *splane, struct drm_plane_state *state,
+	int y1, int y2)
+{
+	int rc, y, x, s;
+	struct drm_framebuffer *fb = state->fb;
+	struct iosys_map vmap[DRM_FORMAT_MAX_PLANES];
+	int const scale = panel->scale;
+	int const src_x = state->src.x1 >> 16;
+	int const src_y = state->src.y1 >> 16;
+	int const width = drm_rect_width(&state->dst);
+	int const pitch = splane->ov.width;
+	u8 const *src;
+	u8 *dst;
+
+	rc = sharp_memory_fb_begin_access(panel, fb, vmap, DMA_FROM_DEVICE);
+	if (rc) {
+		return rc;
+	}
+
+	for (y = y1; y < y2; y++) {
+		src = (u8 const *)vmap[0].vaddr + fb->offsets[0]
+			+ (y * fb->pitches[0]) + src_x;
+		dst = &splane->pixels[(y - src_y) * scale * pitch];
+
+		if (scale == 1) {
+			memcpy(dst, src, width);
+			continue;
+		}
+
+		for (x = 0; x < width; x++) {
+			for (s = 0; s < scale; s++) {
+				dst[(x * scale) + s] = src[x];
+			}
+		}
+		for (s = 1; s < scale; s++) {
+			memcpy(&dst[s * pitch], dst, pitch);
+		}
+	}
+
+	sharp_memory_fb_end_access(panel, fb, vmap, DMA_FROM_DEVICE);
+
+	bitmap_set(panel->dirty, splane->ov.y + (y1 - src_y) * scale,
+		(y2 - y1) * scale);
+
+	return 0;
+}
+
+// Copy the damaged rows of the plane image. If the plane was moved,
+// resized, shown, hidden or rekeyed, the lines it covered before and the
+// ones it covers now are redrawn. The commit tail sends them along with
+// the primary plane
+static void sharp_memory_plane_atomic_update(struct drm_plane *plane,
+	struct drm_atomic_state *state)
+{
+	struct drm_plane_state *old_state, *new_state;
+	struct sharp_memory_panel *panel = drm_to_panel(plane->dev);
+	struct sharp_memory_plane *splane = to_sharp_memory_plane(plane);
+	struct sharp_overlay_t ov;
+	struct drm_rect damage;
+	int key, src_y;
+	int drm_idx;
+
+	old_state = drm_atomic_get_old_plane_state(state, plane);
+	new_state = drm_atomic_get_new_plane_state(state, plane);
+	key = to_sharp_memory_plane_state(new_state)->key;
+
+	ov.x = new_state->dst.x1 * panel->scale;
+	ov.y = new_state->dst.y1 * panel->scale;
+	ov.width = drm_rect_width(&new_state->dst) * panel->scale;
+	ov.height = drm_rect_height(&new_state->dst) * panel->scale;
+	ov.pixels = splane->pixels;
+
+	if (!drm_dev_enter(plane->dev, &drm_idx)) {
+		return;
+	}
+
+	mutex_lock(&panel->flush_lock);
+
+	if (new_state->visible && splane->visible && (key == splane->key)
+	 && (ov.x == splane->ov.x) && (ov.y == splane->ov.y)
+	 && (ov.width == splane->ov.width) && (ov.height == splane->ov.height)) {
+		if (drm_atomic_helper_damage_merged(old_state, new_state, &damage)) {
+			(void)sharp_memory_plane_copy(panel, splane, new_state,
+				damage.y1, damage.y2);
+		}
+		goto out_unlock;
+	}
+
+	if (splane->visible) {
+		bitmap_set(panel->dirty, splane->ov.y, splane->ov.height);
+		splane->visible = false;
+	}
+
+	if (new_state->visible) {
+		splane->ov = ov;
+		splane->key = key;
+		src_y = new_state->src.y1 >> 16;
+		splane->visible = !sharp_memory_plane_copy(panel, splane, new_state,
+			src_y, src_y + drm_rect_height(&new_state->dst));
+	}
+
+out_unlock:
+	mutex_unlock(&panel->flush_lock);
+	drm_dev_exit(drm_idx);
+}
+
+static const struct drm_plane_helper_funcs sharp_memory_plane_hfuncs = {
+	.atomic_check = sharp_memory_plane_atomic_check,
+	.atomic_update = sharp_memory_plane_atomic_update,
+};
+
+static const struct drm_plane_funcs sharp_memory_plane_funcs = {
+	.update_plane = drm_atomic_helper_update_plane,
+	.disable_plane = drm_atomic_helper_disable_plane,
+	.destroy = drm_plane_cleanup,
+	.reset = sharp_memory_plane_reset,
+	.atomic_duplicate_state = sharp_memory_plane_duplicate_state,
+	.atomic_destroy_state = sharp_memory_plane_destroy_state,
+	.atomic_set_property = sharp_memory_plane_atomic_set_property,
+	.atomic_get_property = sharp_memory_plane_atomic_get_property,
+};
+
+static const uint32_t sharp_memory_plane_formats[] = {
+	DRM_FORMAT_R8,
+};
+
+// The cursor is positioned freely, also partly off the CRTC, but not
+// scaled
+static int sharp_memory_cursor_atomic_check(struct drm_plane *plane,
+	struct drm_atomic_state *state)
+{
+	struct drm_plane_state *plane_state;
+	struct drm_crtc_state *crtc_state = NULL;
+	int rc;
+
+	rc = sharp_memory_add_primary(state);
+	if (rc) {
+		return rc;
+	}
+
+	plane_state = drm_atomic_get_new_plane_state(state, plane);
+	if (plane_state->crtc) {
+		crtc_state = drm_atomic_get_new_crtc_state(state, plane_state->crtc);
+	}
+
+	if (plane_state->fb
+	 && ((plane_state->src_w >> 16) > SHARP_MEMORY_CURSOR_SIZE
+	  || (plane_state->src_h >> 16) > SHARP_MEMORY_CURSOR_SIZE)) {
+		return -EINVAL;
+	}
+
+	return drm_atomic_helper_check_plane_state(plane_state, crtc_state,
+		DRM_PLANE_NO_SCALING, DRM_PLANE_NO_SCALING, true, true);
+}
+
+// Threshold the visible part of the cursor image into mask and image bits
+// at panel resolution. Pixels at least half opaque are drawn, with the
+// same gray weights as framebuffer conversion. Caller holds `flush_lock`
+static int sharp_memory_cursor_convert(struct sharp_memory_panel *panel,
+	struct sharp_memory_cursor *cursor, struct drm_plane_state *state)
+{
+	int rc, x, y, sx, sy, on, gray;
+	struct drm_framebuffer *fb = state->fb;
+	struct iosys_map vmap[DRM_FORMAT_MAX_PLANES];
+	struct sharp_memory_profile profile;
+	int const scale = panel->scale;
+	int const src_x = state->src.x1 >> 16;
+	int const src_y = state->src.y1 >> 16;
+	int const width = drm_rect_width(&state->dst);
+	int const height = drm_rect_height(&state->dst);
+	int const pitch = cursor->cur.pitch;
+	u32 const *src;
+	u32 px;
+
+	sharp_memory_get_profile(panel, &profile);
+
+	rc = sharp_memory_fb_begin_access(panel, fb, vmap, DMA_FROM_DEVICE);
+	if (rc) {
+		return rc;
+	}
+
+	memset(cursor->mask, 0, pitch * cursor->cur.height);
+	memset(cursor->image, 0, pitch * cursor->cur.height);
+
+	for (y = 0; y < height; y++) {
+		src = (u32 const *)((u8 const *)vmap[0].vaddr + fb->offsets[0]
+			+ ((src_y + y) * fb->pitches[0])) + src_x;
+
+		for (x = 0; x < width; x++) {
+			px = src[x];
+			if ((px >> 24) < 0x80) {
+				continue;
+			}
+
+			gray = (3 * ((px >> 16) & 0xff) + 6 * ((px >> 8) & 0xff)
+				+ (px & 0xff)) / 10;
+			on = (gray >= profile.cutoff);
+
+			for (sy = 0; sy < scale; sy++) {
+				for (sx = 0; sx < scale; sx++) {
+					sharp_memory_mono_set_pixel(
+						&cursor->mask[((y * scale) + sy) * pitch],
+						(x * scale) + sx, 1);
+					sharp_memory_mono_set_pixel(
+						&cursor->image[((y * scale) + sy) * pitch],
+						(x * scale) + sx, on);
+				}
+			}
+		}
+	}
+
+	sharp_memory_fb_end_access(panel, fb, vmap, DMA_FROM_DEVICE);
+
+	return 0;
+}
+
+// The image is converted again only for a new framebuffer, a new visible
+// part of it, or damage clips. Otherwise, only the lines the cursor left
+// and entered are sent, through the interactive queue when they are few
+static void sharp_memory_cursor_atomic_update(struct drm_plane *plane,
+	struct drm_atomic_state *state)
+{
+	struct drm_plane_state *old_state, *new_state;
+	struct sharp_memory_panel *panel = drm_to_panel(plane->dev);
+	struct sharp_memory_cursor *cursor = to_sharp_memory_cursor(plane);
+	struct sharp_cursor_t const old = cursor->cur;
+	bool const was_visible = cursor->visible;
+	bool convert, moved;
+	int drm_idx, y1, y2;
+
+	old_state = drm_atomic_get_old_plane_state(state, plane);
+	new_state = drm_atomic_get_new_plane_state(state, plane);
+
+	convert = new_state->visible && (!was_visible
+		|| (old_state->fb != new_state->fb)
+		|| !drm_rect_equals(&old_state->src, &new_state->src)
+		|| drm_plane_get_damage_clips_count(new_state));
+
+	if (!drm_dev_enter(plane->dev, &drm_idx)) {
+		return;
+	}
+
+	mutex_lock(&panel->flush_lock);
+
+	cursor->visible = false;
+	if (new_state->visible) {
+		cursor->cur.x = new_state->dst.x1 * panel->scale;
+		cursor->cur.y = new_state->dst.y1 * panel->scale;
+		cursor->cur.width = drm_rect_width(&new_state->dst) * panel->scale;
+		cursor->cur.height = drm_rect_height(&new_state->dst) * panel->scale;
+		cursor->visible = !convert
+			|| !sharp_memory_cursor_convert(panel, cursor, new_state);
+	}
+
+	moved = (old.x != cursor->cur.x) || (old.y != cursor->cur.y);
+
+	// Overlapping old and new lines are sent as one range
+	if (was_visible && cursor->visible && !convert && !moved) {
+		goto out_unlock;
+	} else if (was_visible && cursor->visible
+	 && (old.y <= cursor->cur.y + cursor->cur.height)
+	 && (cursor->cur.y <= old.y + old.height)) {
+		y1 = min(old.y, cursor->cur.y);
+		y2 = max(old.y + old.height, cursor->cur.y + cursor->cur.height);
+		sharp_memory_mark_lines(panel, y1, y2);
+	} else {
+		if (was_visible) {
+			sharp_memory_mark_lines(panel, old.y, old.y + old.height);
+		}
+		if (cursor->visible) {
+			sharp_memory_mark_lines(panel, cursor->cur.y,
+				cursor->cur.y + cursor->cur.height);
+		}
+	}
+
+out_unlock:
+	mutex_unlock(&panel->flush_lock);
+	drm_dev_exit(drm_idx);
+}
+
+static const struct drm_plane_helper_funcs sharp_memory_cursor_hfuncs = {
+	.atomic_check = sharp_memory_cursor_atomic_check,
+	.atomic_update = sharp_memory_cursor_atomic_update,
+};
+
+static const struct drm_plane_funcs sharp_memory_cursor_funcs = {
+	.update_plane = drm_atomic_helper_update_plane,
+	.disable_plane = drm_atomic_helper_disable_plane,
+	.destroy = drm_plane_cleanup,
+	.reset = drm_atomic_helper_plane_reset,
+	.atomic_duplicate_state = drm_atomic_helper_plane_duplicate_state,
+	.atomic_destroy_state = drm_atomic_helper_plane_destroy_state,
+};
+
+static const uint32_t sharp_memory_cursor_formats[] = {
+	DRM_FORMAT_ARGB8888,
+};
+
+// Register the cursor plane as the pipe CRTC's cursor, so that legacy
+// cursor ioctls use it too
+static int sharp_memory_cursor_init(struct device *dev,
+	struct sharp_memory_panel *panel)
+{
+	int rc;
+	struct sharp_memory_cursor *cursor = &panel->cursor;
+	struct drm_device *drm = &panel->drm;
+	int const size = SHARP_MEMORY_CURSOR_SIZE * panel->scale;
+
+	cursor->visible = false;
+	cursor->cur.pitch = DIV_ROUND_UP(size, 8);
+	cursor->mask = devm_kzalloc(dev, cursor->cur.pitch * size, GFP_KERNEL);
+	cursor->image = devm_kzalloc(dev, cursor->cur.pitch * size, GFP_KERNEL);
+	if (!cursor->mask || !cursor->image) {
+		return -ENOMEM;
+	}
+	cursor->cur.mask = cursor->mask;
+	cursor->cur.image = cursor->image;
+
+	rc = drm_universal_plane_init(drm, &cursor->base,
+		drm_crtc_mask(&panel->pipe.crtc), &sharp_memory_cursor_funcs,
+		sharp_memory_cursor_formats, ARRAY_SIZE(sharp_memory_cursor_formats),
+		NULL, DRM_PLANE_TYPE_CURSOR, NULL);
+	if (rc) {
+		return rc;
+	}
+	drm_plane_helper_add(&cursor->base, &sharp_memory_cursor_hfuncs);
+	drm_plane_enable_fb_damage_clips(&cursor->base);
+
+	panel->pipe.crtc.cursor = &cursor->base;
+	drm->mode_config.cursor_width = SHARP_MEMORY_CURSOR_SIZE;
+	drm->mode_config.cursor_height = SHARP_MEMORY_CURSOR_SIZE;
+
+	return 0;
+}
+
+// Register overlay planes and the cursor on the pipe CRTC. Their images
+// are kept at panel resolution
+static int sharp_memory_planes_init(struct device *dev,
+	struct sharp_memory_panel *panel)
+{
+	int rc, i;
+	struct sharp_memory_plane *splane;
+	struct drm_device *drm = &panel->drm;
+
+	panel->key_prop = drm_property_create_signed_range(drm, 0,
+		"SHARP_TRANSPARENT_KEY", -1, 255);
+	if (!panel->key_prop) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < SHARP_MEMORY_OVERLAY_PLANES; i++) {
+		splane = &panel->planes[i];
+		splane->visible = false;
+		splane->key = -1;
+		splane->pixels = devm_kzalloc(dev, panel->width * panel->height,
+			GFP_KERNEL);
+		if (!splane->pixels) {
+			return -ENOMEM;
+		}
+
+		rc = drm_universal_plane_init(drm, &splane->base,
+			drm_crtc_mask(&panel->pipe.crtc), &sharp_memory_plane_funcs,
+			sharp_memory_plane_formats, ARRAY_SIZE(sharp_memory_plane_formats),
+			NULL, DRM_PLANE_TYPE_OVERLAY, NULL);
+		if (rc) {
+			return rc;
+		}
+		drm_plane_helper_add(&splane->base, &sharp_memory_plane_hfuncs);
+		drm_plane_enable_fb_damage_clips(&splane->base);
+		drm_object_attach_property(&splane->base.base, panel->key_prop,
+			I642U64(-1));
+	}
+
+	return sharp_memory_cursor_init(dev, panel);
+}
+
+static const uint32_t sharp_memory_wb_formats[] = {
+#ifdef DRM_FORMAT_R1
+	DRM_FORMAT_R1,
+#endif
+	DRM_FORMAT_R8,
+};
+
+static int sharp_memory_wb_get_modes(struct drm_connector *connector)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(connector->dev);
+
+	return drm_connector_helper_get_modes_fixed(connector, panel->mode);
+}
+
+// Captures are always at panel resolution, also when downscaling
+static int sharp_memory_wb_atomic_check(struct drm_encoder *encoder,
+	struct drm_crtc_state *crtc_state, struct drm_connector_state *conn_state)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(encoder->dev);
+	struct drm_framebuffer *fb;
+	int rc, i;
+
+	// Captures without other changes need the primary too, see
+	// `sharp_memory_add_primary`
+	rc = sharp_memory_add_primary(crtc_state->state);
+	if (rc) {
+		return rc;
+	}
+
+	if (!conn_state->writeback_job || !conn_state->writeback_job->fb) {
+		return 0;
+	}
+	fb = conn_state->writeback_job->fb;
+
+	if ((fb->width != panel->width) || (fb->height != panel->height)) {
+		return -EINVAL;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(sharp_memory_wb_formats); i++) {
+		if (fb->format->format == sharp_memory_wb_formats[i]) {
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+// The job is armed by the commit tail once the planes are updated, and
+// completes once the flush queued after that has sent this commit's
+// lines
+static void sharp_memory_wb_atomic_commit(struct drm_connector *connector,
+	struct drm_atomic_state *state)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(connector->dev);
+	struct drm_connector_state *conn_state;
+	struct drm_framebuffer *fb;
+
+	conn_state = drm_atomic_get_new_connector_state(state, connector);
+	if (!conn_state->writeback_job || !conn_state->writeback_job->fb) {
+		return;
+	}
+	fb = conn_state->writeback_job->fb;
+
+	drm_writeback_queue_job(&panel->wb, conn_state);
+
+	mutex_lock(&panel->flush_lock);
+	sharp_memory_complete_writeback(panel, 0);
+	panel->wb_fb = fb;
+	mutex_unlock(&panel->flush_lock);
+}
+
+static const struct drm_connector_helper_funcs sharp_memory_wb_hfuncs = {
+	.get_modes = sharp_memory_wb_get_modes,
+	.atomic_commit = sharp_memory_wb_atomic_commit,
+};
+
+static const struct drm_encoder_helper_funcs sharp_memory_wb_encoder_hfuncs = {
+	.atomic_check = sharp_memory_wb_atomic_check,
+};
+
+static const struct drm_connector_funcs sharp_memory_wb_funcs = {
+	.reset = drm_atomic_helper_connector_reset,
+	.fill_modes = drm_helper_probe_single_connector_modes,
+	.destroy = drm_connector_cleanup,
+	.atomic_duplicate_state = drm_atomic_helper_connector_duplicate_state,
+	.atomic_destroy_state = drm_atomic_helper_connector_destroy_state,
+};
+
+// Writeback connector on the pipe CRTC, capturing the image sent to the
+// panel
+static int sharp_memory_wb_init(struct sharp_memory_panel *panel)
+{
+	int rc;
+
+	rc = drm_writeback_connector_init(&panel->drm, &panel->wb,
+		&sharp_memory_wb_funcs, &sharp_memory_wb_encoder_hfuncs,
+		sharp_memory_wb_formats, ARRAY_SIZE(sharp_memory_wb_formats),
+		drm_crtc_mask(&panel->pipe.crtc));
+	if (rc) {
+		return rc;
+	}
+	drm_connector_helper_add(&panel->wb.base, &sharp_memory_wb_hfuncs);
+
+	return 0;
+}
+
+static const struct drm_mode_config_helper_funcs sharp_memory_mode_config_helpers = {
+	.atomic_commit_tail = sharp_memory_atomic_commit_tail,
+};
+
+static const struct drm_mode_config_funcs sharp_memory_mode_config_funcs = {
+	.fb_create = create_and_store_fb,
+	.atomic_check = drm_atomic_helper_check,
+	.atomic_commit = drm_atomic_helper_commit,
+};
+
+static const uint32_t sharp_memory_formats[] = {
+	DRM_FORMAT_XRGB8888,
+};
+
+static const struct drm_display_mode sharp_memory_ls027b7dh01_mode = {
+	DRM_SIMPLE_MODE(400, 240, 59, 35),
+};
+
+// Half resolution, each framebuffer pixel covers 2x2 panel pixels
+static const struct drm_display_mode sharp_memory_ls027b7dh01_2x_mode = {
+	DRM_SIMPLE_MODE(200, 120, 59, 35),
+};
+
+static void sharp_memory_select_mode(struct sharp_memory_panel *panel)
+{
+	// Panel dimensions always come from the native mode
+	panel->width = sharp_memory_ls027b7dh01_mode.hdisplay;
+	panel->height = sharp_memory_ls027b7dh01_mode.vdisplay;
+
+	if (g_param_downscale) {
+		panel->mode = &sharp_memory_ls027b7dh01_2x_mode;
+		panel->scale = 2;
+	} else {
+		panel->mode = &sharp_memory_ls027b7dh01_mode;
+		panel->scale = 1;
+	}
+}
+
+static void sharp_memory_wire_release(struct sharp_memory_panel *panel)
+{
+	if (panel->wire) {
+		drm_gem_object_put(&panel->wire->base);
+		panel->wire = NULL;
+	}
+}
+
+// Time to send a full frame at the bus clock, but never faster than the
+// mode refresh rate
+static u64 sharp_memory_frame_ns(struct sharp_memory_panel *panel)
+{
+	u64 frame_ns, bits;
+
+	frame_ns = div_u64(NSEC_PER_SEC, drm_mode_vrefresh(panel->mode));
+
+	if (panel->spi && panel->spi->max_speed_hz) {
+
+		// Command, tagged lines and final trailer
+		bits = (2 + (u64)(2 + panel->width / 8) * panel->height) * 8;
+		frame_ns = max(frame_ns,
+			div_u64(bits * NSEC_PER_SEC, panel->spi->max_speed_hz));
+	}
+
+	return frame_ns;
+}
+
+static void sharp_memory_flush_fini(void *data)
+{
+	struct sharp_memory_panel *panel = data;
+
+	// Remaining work fails its fences once the device is unplugged
+	cancel_work_sync(&panel->urgent_work);
+	destroy_workqueue(panel->flush_wq);
+	destroy_workqueue(panel->convert_wq);
+}
+
+static void sharp_memory_fbdev_setup(struct drm_device *drm)
+{
+	// Native 1bpp fbdev replaces the generic XRGB8888 emulation
+	if (g_param_mono_fbdev) {
+		if (fbdev_probe(drm) == 0) {
+			return;
+		}
+		printk(KERN_WARNING "sharp_memory: falling back to generic fbdev emulation\n");
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
+	drm_client_setup(drm, NULL);
+#else
+	drm_fbdev_generic_setup(drm, 0);
+#endif
+}
+
+static int sharp_memory_bus_load_show(struct seq_file *m, void *data)
+{
+	struct sharp_memory_panel *panel = m->private;
+	struct sharp_memory_load const *load = &panel->load;
+
+	mutex_lock(&panel->flush_lock);
+	seq_printf(m, "mode: %s\n", (load->interlaced) ? "interlaced" : "progressive");
+	seq_printf(m, "fields: %u\n", (load->interlaced) ? load->fields : 1);
+	seq_printf(m, "demand_percent: %u\n", load->percent);
+	seq_printf(m, "interlace_enters: %llu\n", load->enters);
+	seq_printf(m, "interlace_exits: %llu\n", load->exits);
+	seq_printf(m, "interlaced_flushes: %llu\n", load->interlaced_flushes);
+	seq_printf(m, "clear_flushes: %llu\n", load->clear_flushes);
+	mutex_unlock(&panel->flush_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sharp_memory_bus_load);
+
+// Image last sent to the panel, as a binary PBM. PBM set bits are black,
+// panel set bits are white
+static int sharp_memory_frame_show(struct seq_file *m, void *data)
+{
+	struct sharp_memory_panel *panel = m->private;
+	int const tagged_line_len = 2 + panel->width / 8;
+	int y, b;
+
+	seq_printf(m, "P4\n%d %d\n", panel->width, panel->height);
+
+	mutex_lock(&panel->flush_lock);
+	for (y = 0; y < panel->height; y++) {
+		for (b = 1; b < tagged_line_len - 1; b++) {
+			seq_putc(m, ~panel->glass[(y * tagged_line_len) + b]);
+		}
+	}
+	mutex_unlock(&panel->flush_lock);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(sharp_memory_frame);
+
+// Setup not needed to accept the first frame
+static void sharp_memory_late_setup(struct drm_device *drm)
+{
+	struct dentry *dir;
+
+	sharp_memory_fbdev_setup(drm);
+	if (damage_trace_probe(drm)) {
+		printk(KERN_WARNING "sharp_memory: damage trace unavailable\n");
+	}
+
+	// Removed with the trace directory
+	if ((dir = damage_trace_dir()) != NULL) {
+		debugfs_create_file("bus_load", 0444, dir, drm_to_panel(drm),
+			&sharp_memory_bus_load_fops);
+		debugfs_create_file("frame", 0444, dir, drm_to_panel(drm),
+			&sharp_memory_frame_fops);
+	}
+}
+
+static void sharp_memory_setup_work(struct work_struct *work)
+{
+	struct sharp_memory_panel *panel = container_of(work,
+		struct sharp_memory_panel, setup_work);
+
+	sharp_memory_late_setup(&panel->drm);
+}
+
+// Shared by the SPI and QEMU probes
+static int sharp_memory_panel_init(struct device *dev,
+	struct sharp_memory_panel *panel)
+{
+	int rc, line, tagged_line_len, i;
+
+	panel->fb = NULL;
+	panel->shmem = g_param_shmem; // Read-only, matches the selected driver
+	sharp_memory_select_mode(panel);
+
+	mutex_init(&panel->power_lock);
+	mutex_init(&panel->flush_lock);
+	mutex_init(&panel->tx_lock);
+	mutex_init(&panel->qemu_lock);
+	panel->wire = NULL;
+	panel->power_users = 0;
+	panel->pipe_powered = false;
+	panel->parked = false;
+	panel->handoff = g_param_handoff;
+	panel->probe_time = ktime_get();
+	INIT_WORK(&panel->setup_work, sharp_memory_setup_work);
+
+	// Allocate reused heap buffers suitable for SPI source
+	panel->buf = devm_kzalloc(dev, panel->width * panel->height, GFP_KERNEL);
+	panel->spi_3_xfers = devm_kzalloc(dev, sizeof(struct spi_transfer) * 3, GFP_KERNEL);
+	panel->cmd_buf = devm_kzalloc(dev, 1, GFP_KERNEL);
+	panel->trailer_buf = devm_kzalloc(dev, 1, GFP_KERNEL);
+	if (!panel->buf || !panel->spi_3_xfers || !panel->cmd_buf || !panel->trailer_buf) {
+		return -ENOMEM;
+	}
+
+	// Mono shadow starts blank, with every line tagged
+	tagged_line_len = 2 + panel->width / 8;
+	panel->mono = devm_kzalloc(dev, tagged_line_len * panel->height, GFP_KERNEL);
+	panel->glass = devm_kzalloc(dev, tagged_line_len * panel->height, GFP_KERNEL);
+	panel->glass_valid = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	panel->blank = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	if (!panel->glass || !panel->glass_valid || !panel->blank) {
+		return -ENOMEM;
+	}
+	panel->wb_fb = NULL;
+	panel->wb_seq = 0;
+	panel->flush_seq = 0;
+	panel->tx = devm_kzalloc(dev, 2 + tagged_line_len * panel->height, GFP_KERNEL);
+	panel->dirty = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	panel->adopted = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	if (!panel->mono || !panel->tx || !panel->dirty || !panel->adopted) {
+		return -ENOMEM;
+	}
+	panel->tx++; // Room for the command byte before the lines
+	for (line = 0; line < panel->height; line++) {
+		panel->mono[line * tagged_line_len]
+			= sharp_memory_reverse_byte((u8)(line + 1)); // Indexed from 1
+	}
+
+	// The panel is cleared on power up, unless its contents are handed off
+	for (line = 0; line < panel->height; line++) {
+		panel->glass[line * tagged_line_len] = panel->mono[line * tagged_line_len];
+		memset(&panel->glass[(line * tagged_line_len) + 1], 0xff, panel->width / 8);
+	}
+	if (!panel->handoff) {
+		bitmap_fill(panel->glass_valid, panel->height);
+		bitmap_fill(panel->blank, panel->height);
+	} else {
+		bitmap_fill(panel->adopted, panel->height);
+	}
+
+	// Gray cache at framebuffer resolution, empty until rows are converted
+	panel->gray = devm_kzalloc(dev, panel->width * panel->height, GFP_KERNEL);
+	panel->gray_valid = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	if (!panel->gray || !panel->gray_valid) {
+		return -ENOMEM;
+	}
+
+	// Follow module parameters until a client sets connector properties
+	panel->override.cutoff = -1;
+	panel->override.invert = -1;
+	panel->override.dither = -1;
+	sharp_memory_get_profile(panel, &panel->applied);
+
+	// Flush worker
+	spin_lock_init(&panel->fence_lock);
+	INIT_LIST_HEAD(&panel->fences);
+	panel->fence_context = dma_fence_context_alloc(1);
+	panel->fence_seqno = 0;
+	INIT_WORK(&panel->flush_work, sharp_memory_flush_work);
+	INIT_WORK(&panel->params_work, sharp_memory_params_work);
+
+	// Indicator lines
+	spin_lock_init(&panel->urgent_lock);
+	panel->urgent = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	panel->pending = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	panel->chunk = devm_bitmap_zalloc(dev, panel->height, GFP_KERNEL);
+	if (!panel->urgent || !panel->pending || !panel->chunk) {
+		return -ENOMEM;
+	}
+	INIT_WORK(&panel->urgent_work, sharp_memory_urgent_work);
+
+	// Whole frames until the bus is overloaded
+	memset(&panel->load, 0, sizeof(panel->load));
+	panel->load.start = ktime_get();
+	panel->flush_wq = alloc_ordered_workqueue("sharp_drm_flush", WQ_HIGHPRI);
+	if (!panel->flush_wq) {
+		return -ENOMEM;
+	}
+
+	// Conversion bands, run on any CPU at the priority of the flush
+	panel->bands = devm_kcalloc(dev, SHARP_MEMORY_MAX_BANDS,
+		sizeof(*panel->bands), GFP_KERNEL);
+	panel->convert_wq = alloc_workqueue("sharp_drm_convert",
+		WQ_UNBOUND | WQ_HIGHPRI, SHARP_MEMORY_MAX_BANDS);
+	if (!panel->bands || !panel->convert_wq) {
+		if (panel->convert_wq) {
+			destroy_workqueue(panel->convert_wq);
+		}
+		destroy_workqueue(panel->flush_wq);
+		return -ENOMEM;
+	}
+	for (i = 0; i < SHARP_MEMORY_MAX_BANDS; i++) {
+		INIT_WORK(&panel->bands[i].work, sharp_memory_band_work);
+	}
+
+	rc = devm_add_action_or_reset(dev, sharp_memory_flush_fini, panel);
+	if (rc) {
+		return rc;
+	}
+
+	// Emulated vblank
+	panel->flip_event = NULL;
+	panel->frame_period = ns_to_ktime(sharp_memory_frame_ns(panel));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	hrtimer_setup(&panel->vblank_timer, sharp_memory_vblank_timer_callback,
+		CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&panel->vblank_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	panel->vblank_timer.function = sharp_memory_vblank_timer_callback;
+#endif
+
+	return drm_vblank_init(&panel->drm, 1);
+}
+
+DEFINE_DRM_GEM_DMA_FOPS(sharp_memory_fops);
+DEFINE_DRM_GEM_FOPS(sharp_memory_shmem_fops);
+
+static const struct drm_ioctl_desc sharp_memory_ioctls[] = {
+	DRM_IOCTL_DEF_DRV_REDRAW,
+	DRM_IOCTL_DEF_DRV_REDRAW_LINES,
+	DRM_IOCTL_DEF_DRV_REDRAW_RECT,
+	DRM_IOCTL_DEF_DRV_OV_ADD,
+	DRM_IOCTL_DEF_DRV_OV_REM,
+	DRM_IOCTL_DEF_DRV_OV_SHOW,
+	DRM_IOCTL_DEF_DRV_OV_HIDE,
+	DRM_IOCTL_DEF_DRV_OV_CLEAR,
+	DRM_IOCTL_DEF_DRV_OV_UPDATE,
+	DRM_IOCTL_DEF_DRV_OV_MOVE,
+	DRM_IOCTL_DEF_DRV_OV_ADD_TEXT,
+	DRM_IOCTL_DEF_DRV_OV_SET_TEXT,
+	DRM_IOCTL_DEF_DRV_WIRE_MAP,
+	DRM_IOCTL_DEF_DRV_WIRE_FLUSH
+};
+
+static const struct drm_driver sharp_memory_driver = {
+	.driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
+	.fops = &sharp_memory_fops,
+	DRM_GEM_DMA_DRIVER_OPS_VMAP,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
+	.fbdev_probe = drm_fbdev_dma_driver_fbdev_probe,
+#endif
+	.name = "sharp_drm",
+	.desc = "Sharp Memory LCD panel",
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 18, 0)
+	.date = "20260401",
+#endif
+	.major = 1,
+	.minor = 6,
+
+	.open = ioctl_open,
+	.postclose = ioctl_postclose,
+	.ioctls = sharp_memory_ioctls,
+	.num_ioctls = ARRAY_SIZE(sharp_memory_ioctls)
+};
+
+// Same driver with framebuffers in cached shmem pages. The panel is never
+// scanned out by DMA, every pixel is read by the CPU
+static const struct drm_driver sharp_memory_shmem_driver = {
+	.driver_features = DRIVER_GEM | DRIVER_MODESET | DRIVER_ATOMIC,
+	.fops = &sharp_memory_shmem_fops,
+	DRM_GEM_SHMEM_DRIVER_OPS,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
+	.fbdev_probe = drm_fbdev_shmem_driver_fbdev_probe,
+#endif
+	.name = "sharp_drm",
+	.desc = "Sharp Memory LCD panel",
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 18, 0)
+	.date = "20260401",
+#endif
+	.major = 1,
+	.minor = 6,
+
+	.open = ioctl_open,
+	.postclose = ioctl_postclose,
+	.ioctls = sharp_memory_ioctls,
+	.num_ioctls = ARRAY_SIZE(sharp_memory_ioctls)
+};
+
+static const struct drm_driver *sharp_memory_select_driver(void)
+{
+	return (g_param_shmem)
+		? &sharp_memory_shmem_driver
+		: &sharp_memory_driver;
+}
+
+// In handoff mode, the device is usable as soon as it is registered and
+// the rest is finished asynchronously
+static void sharp_memory_start_setup(struct sharp_memory_panel *panel)
+{
+	if (g_param_handoff) {
+		schedule_work(&panel->setup_work);
+	} else {
+		sharp_memory_late_setup(&panel->drm);
+	}
+}
+
+int drm_probe(struct spi_device *spi)
+{
+	const struct drm_display_mode *mode;
+	struct device *dev;
+	struct sharp_memory_panel *panel;
+	struct drm_device *drm;
+	int ret;
+
+	printk(KERN_INFO "sharp_memory: entering drm_probe\n");
+
+	// Get DRM device from SPI struct
+	dev = &spi->dev;
+
+	// The SPI device is used to allocate DMA memory
+	if (!dev->coherent_dma_mask) {
+		ret = dma_coerce_mask_and_coherent(dev, DMA_BIT_MASK(32));
+		if (ret) {
+			dev_warn(dev, "Failed to set dma mask %d\n", ret);
+			return ret;
+		}
+	}
+
+	// Allocate panel storage
+	panel = devm_drm_dev_alloc(dev, sharp_memory_select_driver(),
+		struct sharp_memory_panel, drm);
+	if (IS_ERR(panel)) {
+		printk(KERN_ERR "sharp_memory: failed to allocate panel\n");
+		return PTR_ERR(panel);
+	}
+
+	// Initialize GPIO
+	panel->gpio_disp = devm_gpiod_get(dev, "disp", GPIOD_OUT_HIGH);
+	if (IS_ERR(panel->gpio_disp)) {
+		printk(KERN_INFO "sharp_memory: warning: failed to get GPIO 'disp' from DTS\n");
+		panel->gpio_disp = NULL;
+	}
+
+	panel->gpio_vcom = devm_gpiod_get(dev, "vcom", GPIOD_OUT_LOW);
+	if (IS_ERR(panel->gpio_vcom)) {
+		printk(KERN_INFO "sharp_memory: warning: failed to get GPIO 'vcom' from DTS\n");
+		panel->gpio_vcom = NULL;
+	}
+
+	panel->gpio_cs = devm_gpiod_get(dev, "cs", GPIOD_OUT_HIGH);
+	if (IS_ERR(panel->gpio_cs)) {
+		printk(KERN_INFO "sharp_memory: warning: failed to get GPIO 'cs' from DTS\n");
+		panel->gpio_cs = NULL;
+	}
+
+	// Initalize DRM mode
+	drm = &panel->drm;
+	ret = drmm_mode_config_init(drm);
+	if (ret) {
+		return ret;
+	}
+	drm->mode_config.funcs = &sharp_memory_mode_config_funcs;
+	drm->mode_config.helper_private = &sharp_memory_mode_config_helpers;
+
+	// Initialize panel contents
+	panel->spi = spi;
+	ret = sharp_memory_panel_init(dev, panel);
+	if (ret) {
+		return ret;
+	}
+	mode = panel->mode;
+
+	// Runtime PM follows panel power users, see sharp_memory_power_get()
+	ret = devm_pm_runtime_enable(dev);
+	if (ret) {
+		return ret;
+	}
+
+	// DRM mode settings
+	drm->mode_config.min_width = mode->hdisplay;
+	drm->mode_config.max_width = mode->hdisplay;
+	drm->mode_config.min_height = mode->vdisplay;
+	drm->mode_config.max_height = mode->vdisplay;
+
+	// Configure DRM connector
+	ret = drm_connector_init(drm, &panel->connector, &sharp_memory_connector_funcs,
+		DRM_MODE_CONNECTOR_SPI);
+	if (ret) {
+		return ret;
+	}
+	drm_connector_helper_add(&panel->connector, &sharp_memory_connector_hfuncs);
+	ret = sharp_memory_connector_init_properties(panel);
+	if (ret) {
+		return ret;
+	}
+
+	// Initialize DRM pipe
+	ret = drm_simple_display_pipe_init(drm, &panel->pipe, &sharp_memory_pipe_funcs,
+		sharp_memory_formats, ARRAY_SIZE(sharp_memory_formats),
+		NULL, &panel->connector);
+	if (ret) {
+		return ret;
+	}
+
+	// Enable damaged screen area clips
+	drm_plane_enable_fb_damage_clips(&panel->pipe.plane);
+
+	ret = sharp_memory_planes_init(dev, panel);
+	if (ret) {
+		return ret;
+	}
+
+	ret = sharp_memory_wb_init(panel);
+	if (ret) {
+		return ret;
+	}
+
+	drm_mode_config_reset(drm);
+
+	printk(KERN_INFO "sharp_memory: registering DRM device\n");
+	ret = drm_dev_register(drm, 0);
+	if (ret) {
+		return ret;
+	}
+
+	// fbdev setup
+	spi_set_drvdata(spi, drm);
+	g_drm = drm;
+	sharp_memory_start_setup(panel);
+
+	printk(KERN_INFO "sharp_memory: successful probe\n");
+
+	return 0;
+}
+
+void drm_remove(struct spi_device *spi)
+{
+	struct drm_device *drm;
+	struct device *dev;
+	struct sharp_memory_panel *panel;
+
+	printk(KERN_INFO "sharp_memory: drm_remove\n");
+
+	// Get DRM and panel device from SPI
+	drm = spi_get_drvdata(spi);
+	panel = drm_to_panel(drm);
+
+	// Stop the mono fbdev before the device goes away
+	flush_work(&panel->setup_work);
+	fbdev_remove(drm);
+	g_drm = NULL;
+
+	// Clean up the GPIO descriptors
+	dev = &spi->dev;
+
+	sharp_memory_wire_release(panel);
+
+	if (panel->gpio_disp) {
+		devm_gpiod_put(dev, panel->gpio_disp);
+	}
+	if (panel->gpio_vcom) {
+		devm_gpiod_put(dev, panel->gpio_vcom);
+	}
+
+	drm_dev_unplug(drm);
+	damage_trace_remove();
+	drm_atomic_helper_shutdown(drm);
+}
+
+/* Set the tty at serial_dev to raw mode (clear OPOST) so that Sharp
+ * protocol bytes like 0x0a are not translated to CR+LF by the line
+ * discipline before reaching QEMU.  Uses tty_kopen_exclusive() which
+ * is EXPORT_SYMBOL_GPL since Linux 5.11, avoiding the kernel-internal
+ * file_tty() that was removed from module-visible headers in 6.12.
+ */
+static void prv_set_tty_raw(const char *dev_path)
+{
+	struct path p;
+	dev_t rdev;
+	struct tty_struct *tty;
+	struct ktermios termios;
+
+	if (kern_path(dev_path, LOOKUP_FOLLOW, &p) != 0)
+		return;
+
+	rdev = p.dentry->d_inode->i_rdev;
+	path_put(&p);
+
+	if (!MAJOR(rdev))
+		return;
+
+	tty = tty_kopen_exclusive(rdev);
+	if (IS_ERR(tty)) {
+		printk(KERN_WARNING "sharp_memory: tty_kopen_exclusive(%s): %ld\n",
+		       dev_path, PTR_ERR(tty));
+		return;
+	}
+
+	termios = tty->termios;
+	termios.c_oflag &= ~OPOST;
+	tty_set_termios(tty, &termios);
+	tty_kclose(tty);
+}
+
+int drm_probe_qemu(struct device *dev, const char *serial_dev)
+{
+	const struct drm_display_mode *mode;
+	struct sharp_memory_panel *panel;
+	struct drm_device *drm;
+	int ret;
+
+	printk(KERN_INFO "sharp_memory: entering drm_probe_qemu, serial=%s\n", serial_dev);
+
+	// Platform devices need an explicit DMA mask
+	dev->coherent_dma_mask = DMA_BIT_MASK(32);
+	dev->dma_mask = &dev->coherent_dma_mask;
+
+	panel = devm_drm_dev_alloc(dev, sharp_memory_select_driver(),
+		struct sharp_memory_panel, drm);
+	if (IS_ERR(panel)) {
+		return PTR_ERR(panel);
+	}
+
+	// No SPI or GPIOs in QEMU mode
+	panel->spi = NULL;
+	panel->gpio_disp = NULL;
+	panel->gpio_vcom = NULL;
+	panel->gpio_cs   = NULL;
+
+	// Disable OPOST output processing before opening so Sharp protocol
+	// bytes are not mangled in transit to QEMU.
+	prv_set_tty_raw(serial_dev);
+
+	// Open serial device for display output
+	panel->qemu_file = filp_open(serial_dev, O_WRONLY | O_NOCTTY, 0);
+	if (IS_ERR(panel->qemu_file)) {
+		printk(KERN_ERR "sharp_memory: failed to open %s: %ld\n",
+			serial_dev, PTR_ERR(panel->qemu_file));
+		return PTR_ERR(panel->qemu_file);
+	}
+
+	drm = &panel->drm;
+	ret = drmm_mode_config_init(drm);
+	if (ret) {
+		goto err_close;
+	}
+	drm->mode_config.funcs = &sharp_memory_mode_config_funcs;
+	drm->mode_config.helper_private = &sharp_memory_mode_config_helpers;
+
+	ret = sharp_memory_panel_init(dev, panel);
+	if (ret) {
+		goto err_close;
+	}
+	mode = panel->mode;
+
+	drm->mode_config.min_width = mode->hdisplay;
+	drm->mode_config.max_width = mode->hdisplay;
+	drm->mode_config.min_height = mode->vdisplay;
+	drm->mode_config.max_height = mode->vdisplay;
+
+	ret = drm_connector_init(drm, &panel->connector, &sharp_memory_connector_funcs,
+		DRM_MODE_CONNECTOR_SPI);
+	if (ret) {
+		goto err_close;
+	}
+	drm_connector_helper_add(&panel->connector, &sharp_memory_connector_hfuncs);
+	ret = sharp_memory_connector_init_properties(panel);
+	if (ret) {
+		goto err_close;
+	}
+
+	ret = drm_simple_display_pipe_init(drm, &panel->pipe, &sharp_memory_pipe_funcs,
+		sharp_memory_formats, ARRAY_SIZE(sharp_memory_formats),
+		NULL, &panel->connector);
+	if (ret) {
+		goto err_close;
+	}
+
+	drm_plane_enable_fb_damage_clips(&panel->pipe.plane);
+
+	ret = sharp_memory_planes_init(dev, panel);
+	if (ret) {
+		goto err_close;
+	}
+
+	ret = sharp_memory_wb_init(panel);
+	if (ret) {
+		goto err_close;
+	}
+
+	drm_mode_config_reset(drm);
+
+	printk(KERN_INFO "sharp_memory: registering DRM device (QEMU)\n");
+	ret = drm_dev_register(drm, 0);
+	if (ret) {
+		goto err_close;
+	}
+
+	dev_set_drvdata(dev, drm);
+	g_drm = drm;
+	sharp_memory_start_setup(panel);
+
+	printk(KERN_INFO "sharp_memory: drm_probe_qemu successful\n");
+	return 0;
+
+err_close:
+	filp_close(panel->qemu_file, NULL);
+	panel->qemu_file = NULL;
+	return ret;
+}
+
+void drm_remove_qemu(struct device *dev)
 {
 	struct drm_device *drm;
-	struct device *dev;
 	struct sharp_memory_panel *panel;
 
-	printk(KERN_INFO "sharp_memory: drm_remove\n");
+	printk(KERN_INFO "sharp_memory: drm_remove_qemu\n");
+
+	drm = dev_get_drvdata(dev);
+	panel = drm_to_panel(drm);
+
+	flush_work(&panel->setup_work);
+	fbdev_remove(drm);
+	g_drm = NULL;
+	sharp_memory_wire_release(panel);
+
+	drm_dev_unplug(drm);
+	damage_trace_remove();
+	drm_atomic_helper_shutdown(drm);
+
+	// The flush worker is the serial writer, let it finish first
+	flush_workqueue(panel->flush_wq);
+	if (panel->qemu_file) {
+		filp_close(panel->qemu_file, NULL);
+		panel->qemu_file = NULL;
+	}
+}
+
+int drm_redraw_fb(struct drm_device *drm, int height)
+{
+	struct sharp_memory_panel *panel;
+	struct drm_framebuffer *fb;
+	struct drm_clip_rect dirty_rect;
+
+	if (!drm
+	 || ((panel = drm_to_panel(drm)) == NULL)
+	 || ((fb = panel->fb) == NULL)
+	 || !fb->funcs || !fb->funcs->dirty) {
+		return 0;
+	}
+
+	// Create dirty region
+	dirty_rect.x1 = 0;
+	dirty_rect.x2 = fb->width;
+	dirty_rect.y1 = 0;
+	dirty_rect.y2 = (height > 0)
+		? height
+		: fb->height;
+
+	// Call framebuffer region update handler
+	return fb->funcs->dirty(fb, NULL, 0, 0, &dirty_rect, 1);
+}
+
+struct drm_device *drm_default_device(void)
+{
+	return g_drm;
+}
+
+// Reconvert each run of set bits in `lines`, framebuffer rows, and send
+// all of them in a single multi-line write
+int drm_redraw_lines(struct drm_device *drm, unsigned long const *lines,
+	int nbits)
+{
+	int rc = 0;
+	struct sharp_memory_panel *panel;
+	struct drm_framebuffer *fb;
+	struct drm_rect clip;
+	unsigned int y1, y2;
+	int drm_idx;
+	size_t buf_len;
+
+	if (!drm
+	 || ((panel = drm_to_panel(drm)) == NULL)
+	 || ((fb = panel->fb) == NULL)) {
+		return 0;
+	}
+
+	nbits = min(nbits, (int)fb->height);
+	if (nbits <= 0) {
+		return 0;
+	}
+
+	if (!drm_dev_enter(drm, &drm_idx)) {
+		return -ENODEV;
+	}
+
+	mutex_lock(&panel->flush_lock);
+
+	clip.x1 = 0;
+	clip.x2 = fb->width;
+
+	// Each run is converted and stored in the shadow, then all of them
+	// go out in one transfer
+	for_each_set_bitrange(y1, y2, lines, nbits) {
+		clip.y1 = y1;
+		clip.y2 = y2;
+
+		rc = sharp_memory_clip_mono_tagged(panel, &buf_len,
+			panel->buf, fb, &clip);
+		if (rc) {
+			break;
+		}
+		sharp_memory_store_lines(panel, panel->buf,
+			y1 * panel->scale, y2 * panel->scale);
+	}
+
+	mutex_unlock(&panel->flush_lock);
+
+	if (!rc) {
+		rc = sharp_memory_flush(panel);
+	}
+
+	drm_dev_exit(drm_idx);
+
+	return rc;
+}
+
+// Redraw the framebuffer rows covered by `rect`. With `out_fence`, the
+// rows are converted before returning but sent by the flush worker, and
+// the returned fence signals once they are on the panel
+int drm_redraw_rect(struct drm_device *drm, struct drm_rect const *rect,
+	struct dma_fence **out_fence)
+{
+	int rc;
+	struct sharp_memory_panel *panel;
+	struct drm_framebuffer *fb;
+	struct sharp_memory_fence *fence = NULL;
+	struct drm_rect clip;
+	int drm_idx;
+	size_t buf_len;
+
+	if (!drm
+	 || ((panel = drm_to_panel(drm)) == NULL)
+	 || ((fb = panel->fb) == NULL)) {
+		return -ENODEV;
+	}
+
+	// Panel is only addressable by full lines
+	clip.x1 = 0;
+	clip.x2 = fb->width;
+	clip.y1 = max(rect->y1, 0);
+	clip.y2 = min(rect->y2, (int)fb->height);
+
+	if (out_fence) {
+		fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+		if (!fence) {
+			return -ENOMEM;
+		}
+	}
+
+	if (!drm_dev_enter(drm, &drm_idx)) {
+		kfree(fence);
+		return -ENODEV;
+	}
+
+	mutex_lock(&panel->flush_lock);
+
+	rc = 0;
+	if (clip.y1 < clip.y2) {
+		rc = sharp_memory_clip_mono_tagged(panel, &buf_len, panel->buf, fb, &clip);
+		if (!rc) {
+			sharp_memory_store_lines(panel, panel->buf,
+				clip.y1 * panel->scale, clip.y2 * panel->scale);
+		}
+	}
+
+	// Fence is queued behind the damage it covers, seqnos follow queue order
+	if (!rc && fence) {
+		dma_fence_init(&fence->base, &sharp_memory_fence_ops,
+			&panel->fence_lock, panel->fence_context, ++panel->fence_seqno);
+		list_add_tail(&fence->list, &panel->fences);
+
+		// One reference for the queue, one for the caller
+		dma_fence_get(&fence->base);
+		*out_fence = &fence->base;
+	}
+
+	mutex_unlock(&panel->flush_lock);
+
+	if (rc) {
+		kfree(fence);
+	} else if (fence) {
+		queue_work(panel->flush_wq, &panel->flush_work);
+	} else {
+		rc = sharp_memory_flush(panel);
+	}
+
+	drm_dev_exit(drm_idx);
+
+	return rc;
+}
+
+// `owner` identifies the DRM file for overlays added through ioctls, so
+// that they can be cleared separately from kernel overlays
+void* drm_add_overlay(void *owner, int x, int y, int width, int height,
+	unsigned char const* pixels)
+{
+	void *chunk = kmalloc(sizeof(struct overlay_storage_t), GFP_KERNEL);
+
+	struct overlay_storage_t *entry = (struct overlay_storage_t *)chunk;
+	if (!entry) {
+		return NULL;
+	}
+	entry->overlay.x = x;
+	entry->overlay.y = y;
+	entry->overlay.width = width;
+	entry->overlay.height = height;
+	entry->overlay.pixels = kmemdup(pixels, width * height, GFP_KERNEL);
+	entry->text = NULL;
+	entry->owner = owner;
+	if (!entry->overlay.pixels) {
+		kfree(entry);
+		return NULL;
+	}
+
+	INIT_LIST_HEAD(&entry->list);
+	mutex_lock(&g_overlays_lock);
+	list_add_tail(&entry->list, &g_overlays);
+	mutex_unlock(&g_overlays_lock);
+
+	return entry;
+}
+
+// Caller holds `g_overlays_lock`
+static void sharp_memory_hide_overlay_locked(struct overlay_display_t *entry)
+{
+	list_del(&entry->list);
+	kfree(entry);
+}
+
+// Caller holds `g_overlays_lock`
+static void sharp_memory_remove_overlay_locked(struct overlay_storage_t *entry)
+{
+	struct overlay_display_t *ptr, *next;
+
+	// Displays of a removed overlay would point at freed storage
+	list_for_each_entry_safe(ptr, next, &g_visible_overlays, list) {
+		if (ptr->storage == entry) {
+			sharp_memory_hide_overlay_locked(ptr);
+		}
+	}
+
+	list_del(&entry->list);
+	kfree(entry->overlay.pixels);
+	kfree(entry->text);
+	kfree(entry);
+}
+
+void drm_remove_overlay(void* entry_)
+{
+	struct overlay_storage_t *entry = (struct overlay_storage_t *)entry_;
+
+	mutex_lock(&g_overlays_lock);
+	sharp_memory_remove_overlay_locked(entry);
+	mutex_unlock(&g_overlays_lock);
+}
+
+// Remove every overlay added by `owner`, and its displays
+void drm_clear_overlays(void *owner)
+{
+	struct overlay_storage_t *ptr, *next;
+
+	mutex_lock(&g_overlays_lock);
+	list_for_each_entry_safe(ptr, next, &g_overlays, list) {
+		if (ptr->owner == owner) {
+			sharp_memory_remove_overlay_locked(ptr);
+		}
+	}
+	mutex_unlock(&g_overlays_lock);
+}
+
+void* drm_show_overlay(void* storage_)
+{
+	void *chunk = kmalloc(sizeof(struct overlay_display_t), GFP_KERNEL);
+	struct overlay_display_t *entry = (struct overlay_display_t *)chunk;
+
+	if (!entry) {
+		return NULL;
+	}
+	entry->storage = (struct overlay_storage_t *)storage_;
+
+	INIT_LIST_HEAD(&entry->list);
+	mutex_lock(&g_overlays_lock);
+	list_add_tail(&entry->list, &g_visible_overlays);
+	mutex_unlock(&g_overlays_lock);
+
+	return entry;
+}
+
+void drm_hide_overlay(void* entry_)
+{
+	struct overlay_display_t *entry = (struct overlay_display_t *)entry_;
+
+	mutex_lock(&g_overlays_lock);
+	sharp_memory_hide_overlay_locked(entry);
+	mutex_unlock(&g_overlays_lock);
+}
+
+struct sharp_overlay_t const* drm_overlay_desc(void* storage)
+{
+	return &((struct overlay_storage_t *)storage)->overlay;
+}
+
+void* drm_overlay_display_storage(void* display)
+{
+	return ((struct overlay_display_t *)display)->storage;
+}
+
+// Memory an overlay holds for its owner
+size_t drm_overlay_bytes(void* storage_)
+{
+	struct overlay_storage_t *storage = (struct overlay_storage_t *)storage_;
+
+	return (storage->text)
+		? sizeof(*storage->text)
+		: (size_t)storage->overlay.width * storage->overlay.height;
+}
+
+// Panel lines [y1, y2) covered by `ov`, empty if it is off the panel
+static void sharp_memory_overlay_rows(struct sharp_memory_panel *panel,
+	struct sharp_overlay_t const *ov, int *y1, int *y2)
+{
+	int const y = (ov->y < 0) ? (panel->height + ov->y) : ov->y;
+
+	*y1 = clamp(y, 0, panel->height);
+	*y2 = clamp(y + ov->height, *y1, panel->height);
+}
+
+static bool sharp_memory_overlay_visible(struct overlay_storage_t const *storage)
+{
+	struct overlay_display_t *p;
+	bool visible = false;
+
+	mutex_lock(&g_overlays_lock);
+	list_for_each_entry(p, &g_visible_overlays, list) {
+		if (p->storage == storage) {
+			visible = true;
+			break;
+		}
+	}
+	mutex_unlock(&g_overlays_lock);
+
+	return visible;
+}
+
+// Overlays are drawn when lines are gathered for transfer, so changing
+// one only needs its lines resent from the shadow
+static int sharp_memory_overlay_changed(struct sharp_memory_panel *panel,
+	int y1, int y2)
+{
+	int rc;
+	int drm_idx;
+
+	// Nothing to send until the pipe is enabled
+	if ((y2 <= y1) || !panel->fb) {
+		return 0;
+	}
+
+	if (!drm_dev_enter(&panel->drm, &drm_idx)) {
+		return -ENODEV;
+	}
+
+	rc = sharp_memory_flush(panel);
 
-	// Remove all overlays
-	drm_clear_overlays();
+	drm_dev_exit(drm_idx);
 
-	// Get DRM and panel device from SPI
-	drm = spi_get_drvdata(spi);
+	return rc;
+}
 
-	// Clean up the GPIO descriptors
-	dev = &spi->dev;
-	panel = drm_to_panel(drm);
+// Indicators are created and removed from process context
+void* drm_add_indicator(int x, int y, int width, int height,
+	unsigned char const* pixels)
+{
+	struct sharp_memory_indicator *ind;
+	unsigned long flags;
 
-	if (panel->gpio_disp) {
-		devm_gpiod_put(dev, panel->gpio_disp);
+	if ((ind = kzalloc(sizeof(*ind), GFP_KERNEL)) == NULL) {
+		return NULL;
 	}
-	if (panel->gpio_vcom) {
-		devm_gpiod_put(dev, panel->gpio_vcom);
+	ind->ov.x = x;
+	ind->ov.y = y;
+	ind->ov.width = width;
+	ind->ov.height = height;
+	ind->ov.pixels = kmemdup(pixels, width * height, GFP_KERNEL);
+	if (!ind->ov.pixels) {
+		kfree(ind);
+		return NULL;
 	}
+	ind->visible = false;
 
-	drm_dev_unplug(drm);
-	drm_atomic_helper_shutdown(drm);
+	spin_lock_irqsave(&g_indicators_lock, flags);
+	list_add_tail(&ind->list, &g_indicators);
+	spin_unlock_irqrestore(&g_indicators_lock, flags);
+
+	return ind;
 }
 
-/* Set the tty at serial_dev to raw mode (clear OPOST) so that Sharp
- * protocol bytes like 0x0a are not translated to CR+LF by the line
- * discipline before reaching QEMU.  Uses tty_kopen_exclusive() which
- * is EXPORT_SYMBOL_GPL since Linux 5.11, avoiding the kernel-internal
- * file_tty() that was removed from module-visible headers in 6.12.
- */
-static void prv_set_tty_raw(const char *dev_path)
+void drm_remove_indicator(struct drm_device *drm, void* indicator)
 {
-	struct path p;
-	dev_t rdev;
-	struct tty_struct *tty;
-	struct ktermios termios;
+	struct sharp_memory_indicator *ind
+		= (struct sharp_memory_indicator *)indicator;
+	unsigned long flags;
 
-	if (kern_path(dev_path, LOOKUP_FOLLOW, &p) != 0)
-		return;
+	drm_show_indicator(drm, ind, false);
 
-	rdev = p.dentry->d_inode->i_rdev;
-	path_put(&p);
+	// Lines are drawn under the same lock, nothing refers to it afterwards
+	spin_lock_irqsave(&g_indicators_lock, flags);
+	list_del(&ind->list);
+	spin_unlock_irqrestore(&g_indicators_lock, flags);
 
-	if (!MAJOR(rdev))
+	kfree(ind->ov.pixels);
+	kfree(ind);
+}
+
+// Show or hide an indicator. Callable from any context, including
+// interrupt handlers. Only the indicator lines are queued for sending
+void drm_show_indicator(struct drm_device *drm, void* indicator, bool show)
+{
+	struct sharp_memory_indicator *ind
+		= (struct sharp_memory_indicator *)indicator;
+	struct sharp_memory_panel *panel;
+	unsigned long flags;
+	bool changed;
+	int y1, y2;
+
+	spin_lock_irqsave(&g_indicators_lock, flags);
+	changed = (ind->visible != show);
+	ind->visible = show;
+	spin_unlock_irqrestore(&g_indicators_lock, flags);
+
+	if (!changed || !drm || ((panel = drm_to_panel(drm)) == NULL)) {
 		return;
+	}
 
-	tty = tty_kopen_exclusive(rdev);
-	if (IS_ERR(tty)) {
-		printk(KERN_WARNING "sharp_memory: tty_kopen_exclusive(%s): %ld\n",
-		       dev_path, PTR_ERR(tty));
+	sharp_memory_overlay_rows(panel, &ind->ov, &y1, &y2);
+	if (y2 <= y1) {
 		return;
 	}
 
-	termios = tty->termios;
-	termios.c_oflag &= ~OPOST;
-	tty_set_termios(tty, &termios);
-	tty_kclose(tty);
+	spin_lock_irqsave(&panel->urgent_lock, flags);
+	bitmap_set(panel->urgent, y1, y2 - y1);
+	spin_unlock_irqrestore(&panel->urgent_lock, flags);
+
+	queue_work(system_highpri_wq, &panel->urgent_work);
 }
 
-int drm_probe_qemu(struct device *dev, const char *serial_dev)
+// Replace the pixels of an overlay in its existing allocation. The
+// dimensions must match the ones it was added with
+int drm_update_overlay(struct drm_device *drm, void* storage_, int width,
+	int height, unsigned char const* pixels)
 {
-	const struct drm_display_mode *mode;
+	struct overlay_storage_t *storage = (struct overlay_storage_t *)storage_;
+	struct sharp_overlay_t *ov = &storage->overlay;
 	struct sharp_memory_panel *panel;
-	struct drm_device *drm;
-	int ret;
+	int y1 = 0, y2 = 0;
 
-	printk(KERN_INFO "sharp_memory: entering drm_probe_qemu, serial=%s\n", serial_dev);
+	if (storage->text || (width != ov->width) || (height != ov->height)) {
+		return -EINVAL;
+	}
 
-	// Platform devices need an explicit DMA mask
-	dev->coherent_dma_mask = DMA_BIT_MASK(32);
-	dev->dma_mask = &dev->coherent_dma_mask;
+	if (!drm || ((panel = drm_to_panel(drm)) == NULL)) {
+		memcpy((unsigned char *)ov->pixels, pixels, width * height);
+		return 0;
+	}
 
-	panel = devm_drm_dev_alloc(dev, &sharp_memory_driver,
-		struct sharp_memory_panel, drm);
-	if (IS_ERR(panel)) {
-		return PTR_ERR(panel);
+	mutex_lock(&panel->flush_lock);
+	memcpy((unsigned char *)ov->pixels, pixels, width * height);
+	if (sharp_memory_overlay_visible(storage)) {
+		sharp_memory_overlay_rows(panel, ov, &y1, &y2);
+		bitmap_set(panel->dirty, y1, y2 - y1);
 	}
+	mutex_unlock(&panel->flush_lock);
 
-	// No SPI or GPIOs in QEMU mode
-	panel->spi = NULL;
-	panel->gpio_disp = NULL;
-	panel->gpio_vcom = NULL;
-	panel->gpio_cs   = NULL;
+	return sharp_memory_overlay_changed(panel, y1, y2);
+}
 
-	// Disable OPOST output processing before opening so Sharp protocol
-	// bytes are not mangled in transit to QEMU.
-	prv_set_tty_raw(serial_dev);
+// Move an overlay, resending only the lines it leaves and enters
+int drm_move_overlay(struct drm_device *drm, void* storage_, int x, int y)
+{
+	struct overlay_storage_t *storage = (struct overlay_storage_t *)storage_;
+	struct sharp_overlay_t *ov = &storage->overlay;
+	struct sharp_memory_panel *panel;
+	int old_y1, old_y2, y1 = 0, y2 = 0;
 
-	// Open serial device for display output
-	panel->qemu_file = filp_open(serial_dev, O_WRONLY | O_NOCTTY, 0);
-	if (IS_ERR(panel->qemu_file)) {
-		printk(KERN_ERR "sharp_memory: failed to open %s: %ld\n",
-			serial_dev, PTR_ERR(panel->qemu_file));
-		return PTR_ERR(panel->qemu_file);
+	if (!drm || ((panel = drm_to_panel(drm)) == NULL)) {
+		ov->x = x;
+		ov->y = y;
+		return 0;
 	}
 
-	drm = &panel->drm;
-	ret = drmm_mode_config_init(drm);
-	if (ret) {
-		goto err_close;
+	mutex_lock(&panel->flush_lock);
+	sharp_memory_overlay_rows(panel, ov, &old_y1, &old_y2);
+	ov->x = x;
+	ov->y = y;
+	if (sharp_memory_overlay_visible(storage)) {
+		sharp_memory_overlay_rows(panel, ov, &y1, &y2);
+		bitmap_set(panel->dirty, old_y1, old_y2 - old_y1);
+		bitmap_set(panel->dirty, y1, y2 - y1);
+		y1 = min(y1, old_y1);
+		y2 = max(y2, old_y2);
 	}
-	drm->mode_config.funcs = &sharp_memory_mode_config_funcs;
+	mutex_unlock(&panel->flush_lock);
 
-	panel->fb = NULL;
-	mode = &sharp_memory_ls027b7dh01_mode;
-	panel->mode = mode;
-	panel->width = mode->hdisplay;
-	panel->height = mode->vdisplay;
-
-	panel->buf = devm_kzalloc(dev, panel->width * panel->height, GFP_KERNEL);
-	panel->spi_3_xfers = devm_kzalloc(dev, sizeof(struct spi_transfer) * 3, GFP_KERNEL);
-	panel->cmd_buf = devm_kzalloc(dev, 1, GFP_KERNEL);
-	panel->trailer_buf = devm_kzalloc(dev, 1, GFP_KERNEL);
+	return sharp_memory_overlay_changed(panel, y1, y2);
+}
 
-	drm->mode_config.min_width = mode->hdisplay;
-	drm->mode_config.max_width = mode->hdisplay;
-	drm->mode_config.min_height = mode->vdisplay;
-	drm->mode_config.max_height = mode->vdisplay;
+// Text overlays draw one character per glyph of a built-in console font,
+// such as "VGA8x8". Kernel fonts are already packed one bit per pixel in
+// panel bit order, so glyphs are drawn straight from the font data.
+// Returns an ERR_PTR for unknown fonts or out of memory
+void* drm_add_text(void *owner, int x, int y, char const *font_name,
+	int flags, char const *text)
+{
+	struct font_desc const *font;
+	struct overlay_storage_t *entry;
 
-	ret = drm_connector_init(drm, &panel->connector, &sharp_memory_connector_funcs,
-		DRM_MODE_CONNECTOR_SPI);
-	if (ret) {
-		goto err_close;
+	if (flags & ~(SHARP_TEXT_WHITE | SHARP_TEXT_TRANSPARENT)) {
+		return ERR_PTR(-EINVAL);
 	}
-	drm_connector_helper_add(&panel->connector, &sharp_memory_connector_hfuncs);
 
-	ret = drm_simple_display_pipe_init(drm, &panel->pipe, &sharp_memory_pipe_funcs,
-		sharp_memory_formats, ARRAY_SIZE(sharp_memory_formats),
-		NULL, &panel->connector);
-	if (ret) {
-		goto err_close;
+	if ((font = find_font(font_name)) == NULL) {
+		return ERR_PTR(-ENOENT);
 	}
 
-	drm_plane_enable_fb_damage_clips(&panel->pipe.plane);
-	drm_mode_config_reset(drm);
+	if ((entry = kzalloc(sizeof(*entry), GFP_KERNEL)) == NULL) {
+		return ERR_PTR(-ENOMEM);
+	}
+	if ((entry->text = kzalloc(sizeof(*entry->text), GFP_KERNEL)) == NULL) {
+		kfree(entry);
+		return ERR_PTR(-ENOMEM);
+	}
 
-	printk(KERN_INFO "sharp_memory: registering DRM device (QEMU)\n");
-	ret = drm_dev_register(drm, 0);
-	if (ret) {
-		goto err_close;
+	// Console fonts have 256 glyphs, indexed by character byte
+	entry->text->text.glyph_width = font->width;
+	entry->text->text.glyph_height = font->height;
+	entry->text->text.glyphs = font->data;
+	entry->text->text.chars = entry->text->chars;
+	entry->text->text.flags = flags;
+	entry->text->text.len = strscpy(entry->text->chars, text,
+		SHARP_MEMORY_TEXT_MAX);
+	if (entry->text->text.len < 0) {
+		entry->text->text.len = SHARP_MEMORY_TEXT_MAX - 1;
 	}
 
-	dev_set_drvdata(dev, drm);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 18, 0)
-	drm_client_setup(drm, NULL);
-#else
-	drm_fbdev_generic_setup(drm, 0);
-#endif
+	entry->overlay.x = x;
+	entry->overlay.y = y;
+	entry->overlay.width = entry->text->text.len * font->width;
+	entry->overlay.height = font->height;
+	entry->overlay.pixels = NULL;
+	entry->owner = owner;
 
-	printk(KERN_INFO "sharp_memory: drm_probe_qemu successful\n");
-	return 0;
+	INIT_LIST_HEAD(&entry->list);
+	mutex_lock(&g_overlays_lock);
+	list_add_tail(&entry->list, &g_overlays);
+	mutex_unlock(&g_overlays_lock);
 
-err_close:
-	filp_close(panel->qemu_file, NULL);
-	panel->qemu_file = NULL;
-	return ret;
+	return entry;
 }
 
-void drm_remove_qemu(struct device *dev)
+// Replace the text of a text overlay. Only its lines are resent
+int drm_set_text(struct drm_device *drm, void* storage_, char const *text)
 {
-	struct drm_device *drm;
-	struct sharp_memory_panel *panel;
+	struct overlay_storage_t *storage = (struct overlay_storage_t *)storage_;
+	struct sharp_memory_panel *panel = NULL;
+	struct sharp_text_t *t;
+	int y1 = 0, y2 = 0;
 
-	printk(KERN_INFO "sharp_memory: drm_remove_qemu\n");
+	if (!storage->text) {
+		return -EINVAL;
+	}
+	t = &storage->text->text;
 
-	drm = dev_get_drvdata(dev);
-	panel = drm_to_panel(drm);
+	if (drm) {
+		panel = drm_to_panel(drm);
+		mutex_lock(&panel->flush_lock);
+	}
 
-	if (panel->qemu_file) {
-		filp_close(panel->qemu_file, NULL);
-		panel->qemu_file = NULL;
+	t->len = strscpy(storage->text->chars, text, SHARP_MEMORY_TEXT_MAX);
+	if (t->len < 0) {
+		t->len = SHARP_MEMORY_TEXT_MAX - 1;
 	}
+	storage->overlay.width = t->len * t->glyph_width;
 
-	drm_dev_unplug(drm);
-	drm_atomic_helper_shutdown(drm);
+	if (!panel) {
+		return 0;
+	}
+
+	// The glyph height doesn't change, old and new text share lines
+	if (sharp_memory_overlay_visible(storage)) {
+		sharp_memory_overlay_rows(panel, &storage->overlay, &y1, &y2);
+		sharp_memory_mark_lines(panel, y1, y2);
+	}
+	mutex_unlock(&panel->flush_lock);
+
+	return sharp_memory_overlay_changed(panel, y1, y2);
 }
 
-int drm_redraw_fb(struct drm_device *drm, int height)
+int drm_redraw_mono(struct drm_device *drm, u8 const *src, size_t pitch,
+	int y1, int y2)
 {
+	int rc;
 	struct sharp_memory_panel *panel;
-	struct drm_framebuffer *fb;
-	struct drm_clip_rect dirty_rect;
+	int drm_idx;
 
-	if (!drm
-	 || ((panel = drm_to_panel(drm)) == NULL)
-	 || ((fb = panel->fb) == NULL)
-	 || !fb->funcs || !fb->funcs->dirty) {
+	if (!drm || ((panel = drm_to_panel(drm)) == NULL)) {
 		return 0;
 	}
 
-	// Create dirty region
-	dirty_rect.x1 = 0;
-	dirty_rect.x2 = fb->width;
-	dirty_rect.y1 = 0;
-	dirty_rect.y2 = (height > 0)
-		? height
-		: fb->height;
+	y1 = max(y1, 0);
+	y2 = min(y2, (int)panel->height);
+	if (y2 <= y1) {
+		return 0;
+	}
 
-	// Call framebuffer region update handler
-	return fb->funcs->dirty(fb, NULL, 0, 0, &dirty_rect, 1);
+	if (!drm_dev_enter(drm, &drm_idx)) {
+		return -ENODEV;
+	}
+
+	mutex_lock(&panel->flush_lock);
+
+	// Source is already mono, tag lines directly into the shadow
+	(void)sharp_memory_mono_to_mono_tagged(
+		&panel->mono[y1 * (2 + panel->width / 8)], src, pitch,
+		panel->width, y1, y2);
+	sharp_memory_mark_lines(panel, y1, y2);
+	sharp_memory_invalidate_gray(panel, y1, y2);
+
+	mutex_unlock(&panel->flush_lock);
+
+	rc = sharp_memory_flush(panel);
+
+	drm_dev_exit(drm_idx);
+
+	return rc;
 }
 
-void* drm_add_overlay(int x, int y, int width, int height,
-	unsigned char const* pixels)
+// Apply changed module parameters to the cached image and send it.
+// Only queues work, so it is safe to call from any context
+void drm_apply_params(struct drm_device *drm)
 {
-	void *chunk = kmalloc(sizeof(struct overlay_storage_t), GFP_KERNEL);
+	struct sharp_memory_panel *panel;
 
-	struct overlay_storage_t *entry = (struct overlay_storage_t *)chunk;
-	entry->overlay.x = x;
-	entry->overlay.y = y;
-	entry->overlay.width = width;
-	entry->overlay.height = height;
-	entry->overlay.pixels = kmemdup(pixels, width * height, GFP_KERNEL);
+	if (!drm || ((panel = drm_to_panel(drm)) == NULL)) {
+		return;
+	}
 
-	INIT_LIST_HEAD(&entry->list);
-	list_add_tail(&entry->list, &g_overlays);
+	queue_work(panel->flush_wq, &panel->params_work);
+}
 
-	return entry;
+int drm_pm_suspend(struct drm_device *drm)
+{
+	return (drm) ? sharp_memory_park(drm_to_panel(drm)) : 0;
 }
 
-void drm_remove_overlay(void* entry_)
+int drm_pm_resume(struct drm_device *drm)
 {
-	struct overlay_storage_t *entry = (struct overlay_storage_t *)entry_;
+	return (drm) ? sharp_memory_unpark(drm_to_panel(drm)) : 0;
+}
 
-	list_del(&entry->list);
-	kfree(entry->overlay.pixels);
-	kfree(entry);
+int drm_power_get(struct drm_device *drm)
+{
+	return sharp_memory_power_get(drm_to_panel(drm));
 }
 
-void drm_clear_overlays(void)
+void drm_power_put(struct drm_device *drm)
 {
-	{
-		struct overlay_display_t *ptr, *next;
-		list_for_each_entry_safe(ptr, next, &g_visible_overlays, list) {
-			drm_hide_overlay(ptr);
-		}
+	sharp_memory_power_put(drm_to_panel(drm));
+}
+
+void drm_panel_size(struct drm_device *drm, int *width, int *height)
+{
+	struct sharp_memory_panel *panel = drm_to_panel(drm);
+
+	*width = panel->width;
+	*height = panel->height;
+}
+
+// Create the wire buffer on first use, with every line pre-tagged so that
+// clients only write pixel bytes
+static struct drm_gem_dma_object *sharp_memory_wire_get(
+	struct sharp_memory_panel *panel)
+{
+	struct drm_gem_dma_object *wire;
+	int line;
+	int const tagged_line_len = 2 + panel->width / 8;
+	u8 *dst;
+
+	mutex_lock(&panel->flush_lock);
+
+	if (panel->wire) {
+		goto out_unlock;
 	}
 
-	{
-		struct overlay_storage_t *ptr, *next;
-		list_for_each_entry_safe(ptr, next, &g_overlays, list) {
-			drm_remove_overlay(ptr);
-		}
+	wire = drm_gem_dma_create(&panel->drm, tagged_line_len * panel->height);
+	if (IS_ERR(wire)) {
+		mutex_unlock(&panel->flush_lock);
+		return wire;
+	}
+
+	for (line = 0; line < panel->height; line++) {
+		dst = (u8 *)wire->vaddr + (line * tagged_line_len);
+		memset(dst, 0, tagged_line_len);
+		dst[0] = sharp_memory_reverse_byte((u8)(line + 1)); // Indexed from 1
 	}
+
+	panel->wire = wire;
+
+out_unlock:
+	mutex_unlock(&panel->flush_lock);
+
+	return panel->wire;
 }
 
-void* drm_show_overlay(void* storage_)
+int drm_wire_map(struct drm_device *drm, struct drm_file *file,
+	struct sharp_memory_ioctl_wire_map_t *map)
 {
-	void *chunk = kmalloc(sizeof(struct overlay_display_t), GFP_KERNEL);
-	struct overlay_display_t *entry = (struct overlay_display_t *)chunk;
+	int rc;
+	struct sharp_memory_panel *panel = drm_to_panel(drm);
+	struct drm_gem_dma_object *wire;
+	u32 handle;
 
-	entry->storage = (struct overlay_storage_t *)storage_;
+	wire = sharp_memory_wire_get(panel);
+	if (IS_ERR(wire)) {
+		return PTR_ERR(wire);
+	}
 
-	INIT_LIST_HEAD(&entry->list);
-	list_add_tail(&entry->list, &g_visible_overlays);
+	// Handle takes its own reference and grants mmap access to `file`
+	rc = drm_gem_handle_create(file, &wire->base, &handle);
+	if (rc) {
+		return rc;
+	}
 
-	return entry;
+	map->out_handle = handle;
+	map->out_size = wire->base.size;
+	map->out_pitch = 2 + panel->width / 8;
+	map->out_width = panel->width;
+	map->out_height = panel->height;
+	map->out_offset = drm_vma_node_offset_addr(&wire->base.vma_node);
+
+	return 0;
 }
 
-void drm_hide_overlay(void* entry_)
+int drm_wire_flush(struct drm_device *drm, int y1, int y2)
 {
-	struct overlay_display_t *entry = (struct overlay_display_t *)entry_;
+	int rc;
+	struct sharp_memory_panel *panel = drm_to_panel(drm);
+	int const tagged_line_len = 2 + panel->width / 8;
+	int drm_idx;
 
-	list_del(&entry->list);
-	kfree(entry);
-}
+	y1 = max(y1, 0);
+	y2 = min(y2, (int)panel->height);
+	if (!panel->wire || (y2 <= y1)) {
+		return 0;
+	}
+
+	if (!drm_dev_enter(drm, &drm_idx)) {
+		return -ENODEV;
+	}
 
+	mutex_lock(&panel->flush_lock);
+
+	// Pixel bytes start after each line tag. Tags are rewritten on copy
+	// so a client can't address lines outside the flushed range
+	(void)sharp_memory_mono_to_mono_tagged(
+		&panel->mono[y1 * tagged_line_len],
+		(u8 const *)panel->wire->vaddr + 1, tagged_line_len,
+		panel->width, y1, y2);
+	sharp_memory_mark_lines(panel, y1, y2);
+	sharp_memory_invalidate_gray(panel, y1, y2);
+
+	mutex_unlock(&panel->flush_lock);
+
+	rc = sharp_memory_flush(panel);
+
+	drm_dev_exit(drm_idx);
+
+	return rc;
+}
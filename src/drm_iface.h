@@ -2,6 +2,7 @@
 #define DRM_IFACE_H_
 
 #include <linux/delay.h>
+#include <linux/dma-fence.h>
 #include <linux/gpio/consumer.h>
 #include <linux/module.h>
 #include <linux/property.h>
@@ -25,18 +26,51 @@
 #include <drm/drm_probe_helper.h>
 #include <drm/drm_simple_kms_helper.h>
 
+#include "ioctl_iface.h"
+
 int drm_probe(struct spi_device *spi);
 void drm_remove(struct spi_device *spi);
 
 int drm_probe_qemu(struct device *dev, const char *serial_dev);
 void drm_remove_qemu(struct device *dev);
 
+struct drm_device *drm_default_device(void);
 int drm_redraw_fb(struct drm_device *drm, int height);
-void* drm_add_overlay(int x, int y, int width, int height,
+int drm_redraw_lines(struct drm_device *drm, unsigned long const *lines,
+	int nbits);
+int drm_redraw_rect(struct drm_device *drm, struct drm_rect const *rect,
+	struct dma_fence **out_fence);
+int drm_redraw_mono(struct drm_device *drm, u8 const *src, size_t pitch,
+	int y1, int y2);
+void drm_apply_params(struct drm_device *drm);
+
+int drm_pm_suspend(struct drm_device *drm);
+int drm_pm_resume(struct drm_device *drm);
+
+int drm_power_get(struct drm_device *drm);
+void drm_power_put(struct drm_device *drm);
+void drm_panel_size(struct drm_device *drm, int *width, int *height);
+int drm_wire_map(struct drm_device *drm, struct drm_file *file,
+	struct sharp_memory_ioctl_wire_map_t *map);
+int drm_wire_flush(struct drm_device *drm, int y1, int y2);
+void* drm_add_overlay(void *owner, int x, int y, int width, int height,
 	unsigned char const* pixels);
 void drm_remove_overlay(void* storage);
-void drm_clear_overlays(void);
+void drm_clear_overlays(void *owner);
 void* drm_show_overlay(void* storage);
 void drm_hide_overlay(void* display);
+struct sharp_overlay_t const* drm_overlay_desc(void* storage);
+void* drm_overlay_display_storage(void* display);
+size_t drm_overlay_bytes(void* storage);
+int drm_update_overlay(struct drm_device *drm, void* storage, int width,
+	int height, unsigned char const* pixels);
+int drm_move_overlay(struct drm_device *drm, void* storage, int x, int y);
+void* drm_add_text(void *owner, int x, int y, char const *font_name,
+	int flags, char const *text);
+int drm_set_text(struct drm_device *drm, void* storage, char const *text);
+void* drm_add_indicator(int x, int y, int width, int height,
+	unsigned char const* pixels);
+void drm_remove_indicator(struct drm_device *drm, void* indicator);
+void drm_show_indicator(struct drm_device *drm, void* indicator, bool show);
 
 #endif
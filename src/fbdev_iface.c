@@ -0,0 +1,283 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Native 1bpp fbdev for the Sharp Memory LCD
+ *
+ * The generic DRM fbdev emulation renders fbcon at 32bpp, which is then
+ * converted to grayscale and thresholded on every flush. This fbdev
+ * exposes the panel as a monochrome visual, so drawing operations write
+ * panel bits directly and only the touched lines are sent.
+ */
+
+#include <linux/fb.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include <drm/drm_auth.h>
+#include <drm/drm_device.h>
+
+#include "drm_iface.h"
+#include "fbdev_iface.h"
+
+struct sharp_fbdev
+{
+	struct drm_device *drm;
+	struct fb_info *info;
+
+	// Lines touched since the last flush, [dirty_y1, dirty_y2)
+	spinlock_t dirty_lock;
+	int dirty_y1, dirty_y2;
+	struct work_struct flush_work;
+};
+
+static struct sharp_fbdev *g_fbdev = NULL;
+
+static void sharp_fbdev_damage(struct fb_info *info, int y, int height)
+{
+	struct sharp_fbdev *fbdev = info->par;
+	unsigned long flags;
+
+	if (height <= 0) {
+		return;
+	}
+
+	spin_lock_irqsave(&fbdev->dirty_lock, flags);
+	fbdev->dirty_y1 = min(fbdev->dirty_y1, y);
+	fbdev->dirty_y2 = max(fbdev->dirty_y2, y + height);
+	spin_unlock_irqrestore(&fbdev->dirty_lock, flags);
+
+	// Drawing operations can run in atomic context, SPI transfer can't
+	schedule_work(&fbdev->flush_work);
+}
+
+static void sharp_fbdev_damage_range(struct fb_info *info, loff_t off,
+	size_t len)
+{
+	u32 const pitch = info->fix.line_length;
+	int y1, y2;
+
+	if (len == 0) {
+		return;
+	}
+
+	y1 = off / pitch;
+	y2 = DIV_ROUND_UP(off + len, pitch);
+	sharp_fbdev_damage(info, y1, y2 - y1);
+}
+
+static void sharp_fbdev_flush_work(struct work_struct *work)
+{
+	struct sharp_fbdev *fbdev = container_of(work, struct sharp_fbdev,
+		flush_work);
+	struct fb_info *info = fbdev->info;
+	unsigned long flags;
+	int y1, y2;
+
+	spin_lock_irqsave(&fbdev->dirty_lock, flags);
+	y1 = fbdev->dirty_y1;
+	y2 = fbdev->dirty_y2;
+	fbdev->dirty_y1 = INT_MAX;
+	fbdev->dirty_y2 = 0;
+	spin_unlock_irqrestore(&fbdev->dirty_lock, flags);
+
+	if (y2 <= y1) {
+		return;
+	}
+
+	// Like the DRM fbdev helpers, stay off the panel while a DRM master
+	// such as a compositor owns the display
+	if (!drm_master_internal_acquire(fbdev->drm)) {
+		return;
+	}
+
+	(void)drm_redraw_mono(fbdev->drm, info->screen_buffer,
+		info->fix.line_length, y1, y2);
+
+	drm_master_internal_release(fbdev->drm);
+}
+
+// Writes through mmap are tracked by page
+static void sharp_fbdev_deferred_io(struct fb_info *info,
+	struct list_head *pagereflist)
+{
+	struct fb_deferred_io_pageref *pageref;
+
+	list_for_each_entry(pageref, pagereflist, list) {
+		sharp_fbdev_damage_range(info, pageref->offset, PAGE_SIZE);
+	}
+}
+
+static struct fb_deferred_io sharp_fbdev_defio = {
+	.delay = HZ / 30,
+	.deferred_io = sharp_fbdev_deferred_io,
+};
+
+static ssize_t sharp_fbdev_read(struct fb_info *info, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	return fb_sys_read(info, buf, count, ppos);
+}
+
+static ssize_t sharp_fbdev_write(struct fb_info *info, const char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	loff_t pos = *ppos;
+	ssize_t rc;
+
+	rc = fb_sys_write(info, buf, count, ppos);
+	if (rc > 0) {
+		sharp_fbdev_damage_range(info, pos, rc);
+	}
+
+	return rc;
+}
+
+static void sharp_fbdev_fillrect(struct fb_info *info,
+	const struct fb_fillrect *rect)
+{
+	sys_fillrect(info, rect);
+	sharp_fbdev_damage(info, rect->dy, rect->height);
+}
+
+static void sharp_fbdev_copyarea(struct fb_info *info,
+	const struct fb_copyarea *area)
+{
+	sys_copyarea(info, area);
+	sharp_fbdev_damage(info, area->dy, area->height);
+}
+
+static void sharp_fbdev_imageblit(struct fb_info *info,
+	const struct fb_image *image)
+{
+	sys_imageblit(info, image);
+	sharp_fbdev_damage(info, image->dy, image->height);
+}
+
+static int sharp_fbdev_blank(int blank, struct fb_info *info)
+{
+	// Memory LCD retains its contents, nothing to power down
+	return 0;
+}
+
+static const struct fb_ops sharp_fbdev_ops = {
+	.owner = THIS_MODULE,
+	.fb_read = sharp_fbdev_read,
+	.fb_write = sharp_fbdev_write,
+	.fb_fillrect = sharp_fbdev_fillrect,
+	.fb_copyarea = sharp_fbdev_copyarea,
+	.fb_imageblit = sharp_fbdev_imageblit,
+	.fb_blank = sharp_fbdev_blank,
+	.fb_mmap = fb_deferred_io_mmap,
+};
+
+int fbdev_probe(struct drm_device *drm)
+{
+	int rc, width, height;
+	size_t size;
+	struct sharp_fbdev *fbdev;
+	struct fb_info *info;
+
+	printk(KERN_INFO "sharp_memory: registering 1bpp fbdev\n");
+
+	drm_panel_size(drm, &width, &height);
+	size = (width / 8) * height;
+
+	info = framebuffer_alloc(sizeof(struct sharp_fbdev), drm->dev);
+	if (!info) {
+		return -ENOMEM;
+	}
+
+	fbdev = info->par;
+	fbdev->drm = drm;
+	fbdev->info = info;
+	spin_lock_init(&fbdev->dirty_lock);
+	fbdev->dirty_y1 = INT_MAX;
+	fbdev->dirty_y2 = 0;
+	INIT_WORK(&fbdev->flush_work, sharp_fbdev_flush_work);
+
+	// Deferred I/O tracks mmap writes through vmalloc pages
+	info->screen_buffer = vzalloc(PAGE_ALIGN(size));
+	if (!info->screen_buffer) {
+		rc = -ENOMEM;
+		goto err_release;
+	}
+
+	info->fbops = &sharp_fbdev_ops;
+	info->flags = FBINFO_VIRTFB;
+
+	strscpy(info->fix.id, "sharp_drm", sizeof(info->fix.id));
+	info->fix.type = FB_TYPE_PACKED_PIXELS;
+	info->fix.visual = FB_VISUAL_MONO10; // Set bits are white, as the panel
+	info->fix.line_length = width / 8;
+	info->fix.smem_len = size;
+	info->fix.accel = FB_ACCEL_NONE;
+
+	info->var.xres = width;
+	info->var.yres = height;
+	info->var.xres_virtual = width;
+	info->var.yres_virtual = height;
+	info->var.bits_per_pixel = 1;
+	info->var.red.length = 1;
+	info->var.green.length = 1;
+	info->var.blue.length = 1;
+	info->var.activate = FB_ACTIVATE_NOW;
+	info->var.height = -1;
+	info->var.width = -1;
+
+	info->fbdefio = &sharp_fbdev_defio;
+	rc = fb_deferred_io_init(info);
+	if (rc) {
+		goto err_free;
+	}
+
+	// Keep the panel powered for as long as the console can draw to it
+	rc = drm_power_get(drm);
+	if (rc) {
+		goto err_defio;
+	}
+
+	rc = register_framebuffer(info);
+	if (rc) {
+		goto err_power;
+	}
+
+	g_fbdev = fbdev;
+
+	printk(KERN_INFO "sharp_memory: registered fb%d\n", info->node);
+
+	return 0;
+
+err_power:
+	drm_power_put(drm);
+err_defio:
+	fb_deferred_io_cleanup(info);
+err_free:
+	vfree(info->screen_buffer);
+err_release:
+	framebuffer_release(info);
+	return rc;
+}
+
+void fbdev_remove(struct drm_device *drm)
+{
+	struct sharp_fbdev *fbdev = g_fbdev;
+	struct fb_info *info;
+
+	if (!fbdev || (fbdev->drm != drm)) {
+		return;
+	}
+
+	g_fbdev = NULL;
+	info = fbdev->info;
+
+	unregister_framebuffer(info);
+	fb_deferred_io_cleanup(info);
+	cancel_work_sync(&fbdev->flush_work);
+
+	drm_power_put(drm);
+
+	vfree(info->screen_buffer);
+	framebuffer_release(info);
+}
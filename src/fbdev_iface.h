@@ -0,0 +1,9 @@
+#ifndef FBDEV_IFACE_H_
+#define FBDEV_IFACE_H_
+
+#include <drm/drm_device.h>
+
+int fbdev_probe(struct drm_device *drm);
+void fbdev_remove(struct drm_device *drm);
+
+#endif
@@ -1,9 +1,16 @@
 #include <linux/types.h>
 #include <linux/ioctl.h>
 #include <linux/cdev.h>
+#include <linux/err.h>
 #include <linux/errno.h>
 #include <linux/overflow.h>
 #include <linux/uaccess.h>
+#include <linux/bitmap.h>
+#include <linux/file.h>
+#include <linux/sync_file.h>
+#include <linux/idr.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
 
 #include "params_iface.h"
 #include "drm_iface.h"
@@ -24,15 +31,166 @@ int sharp_memory_ioctl_redraw(struct drm_device *dev, void *data,
 	return 0;
 }
 
+int sharp_memory_ioctl_redraw_lines(struct drm_device *dev, void *lines_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_redraw_lines_t *lines
+		= (struct sharp_memory_ioctl_redraw_lines_t *)lines_;
+	DECLARE_BITMAP(bitmap, SHARP_MEMORY_MAX_LINES);
+
+	bitmap_from_arr64(bitmap, lines->lines, SHARP_MEMORY_MAX_LINES);
+
+	return drm_redraw_lines(dev, bitmap, SHARP_MEMORY_MAX_LINES);
+}
+
+int sharp_memory_ioctl_redraw_rect(struct drm_device *dev, void *rect_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_redraw_rect_t *rect
+		= (struct sharp_memory_ioctl_redraw_rect_t *)rect_;
+	struct drm_rect clip;
+	struct dma_fence *fence = NULL;
+	struct sync_file *sync_file;
+	int rc, fd;
+
+	if (rect->flags & ~SHARP_MEMORY_REDRAW_OUT_FENCE) {
+		return -EINVAL;
+	}
+
+	drm_rect_init(&clip, rect->x1, rect->y1,
+		rect->x2 - rect->x1, rect->y2 - rect->y1);
+
+	if (!(rect->flags & SHARP_MEMORY_REDRAW_OUT_FENCE)) {
+		rect->out_fence_fd = -1;
+		return drm_redraw_rect(dev, &clip, NULL);
+	}
+
+	// Reserve the descriptor first, the redraw can't be undone once queued
+	if ((fd = get_unused_fd_flags(O_CLOEXEC)) < 0) {
+		return fd;
+	}
+
+	if ((rc = drm_redraw_rect(dev, &clip, &fence))) {
+		put_unused_fd(fd);
+		return rc;
+	}
+
+	// Sync file takes its own fence reference
+	sync_file = sync_file_create(fence);
+	dma_fence_put(fence);
+	if (!sync_file) {
+		put_unused_fd(fd);
+		return -ENOMEM;
+	}
+
+	fd_install(fd, sync_file->file);
+	rect->out_fence_fd = fd;
+
+	return 0;
+}
+
+int sharp_memory_ioctl_wire_map(struct drm_device *dev, void *map_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_wire_map_t *map
+		= (struct sharp_memory_ioctl_wire_map_t *)map_;
+
+	return drm_wire_map(dev, file, map);
+}
+
+int sharp_memory_ioctl_wire_flush(struct drm_device *dev, void *flush_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_wire_flush_t *flush
+		= (struct sharp_memory_ioctl_wire_flush_t *)flush_;
+
+	return drm_wire_flush(dev, flush->y1, flush->y2);
+}
+
+// Overlays and displays created through one DRM file. Handles index the
+// IDRs and are validated on every use. Protected by `lock`
+struct sharp_memory_file
+{
+	struct mutex lock;
+	struct idr overlays;
+	struct idr displays;
+	size_t overlay_bytes;
+};
+
+int ioctl_open(struct drm_device *dev, struct drm_file *file)
+{
+	struct sharp_memory_file *priv;
+
+	if ((priv = kzalloc(sizeof(*priv), GFP_KERNEL)) == NULL) {
+		return -ENOMEM;
+	}
+
+	mutex_init(&priv->lock);
+	// Handle 0 is never valid
+	idr_init_base(&priv->overlays, 1);
+	idr_init_base(&priv->displays, 1);
+	priv->overlay_bytes = 0;
+
+	file->driver_priv = priv;
+
+	return 0;
+}
+
+// Remove every overlay and display of `priv`. Returns true if any overlay
+// was displayed. Caller holds `priv->lock`
+static bool sharp_memory_file_clear(struct sharp_memory_file *priv)
+{
+	void *storage, *display;
+	int id;
+	bool hidden = false;
+
+	idr_for_each_entry(&priv->displays, display, id) {
+		idr_remove(&priv->displays, id);
+		drm_hide_overlay(display);
+		hidden = true;
+	}
+
+	idr_for_each_entry(&priv->overlays, storage, id) {
+		idr_remove(&priv->overlays, id);
+		drm_remove_overlay(storage);
+	}
+	priv->overlay_bytes = 0;
+
+	return hidden;
+}
+
+void ioctl_postclose(struct drm_device *dev, struct drm_file *file)
+{
+	struct sharp_memory_file *priv = file->driver_priv;
+	bool hidden;
+
+	mutex_lock(&priv->lock);
+	hidden = sharp_memory_file_clear(priv);
+	mutex_unlock(&priv->lock);
+
+	idr_destroy(&priv->overlays);
+	idr_destroy(&priv->displays);
+	mutex_destroy(&priv->lock);
+	kfree(priv);
+	file->driver_priv = NULL;
+
+	if (hidden) {
+		drm_redraw_fb(dev, -1);
+	}
+}
+
 int sharp_memory_ioctl_ov_add(struct drm_device *dev,
 	void *in_overlay_out_storage, struct drm_file *file)
 {
 	union sharp_memory_ioctl_ov_add_t *add
 		= (union sharp_memory_ioctl_ov_add_t *)in_overlay_out_storage;
+	struct sharp_memory_file *priv = file->driver_priv;
 	unsigned char *pixels = NULL;
 	unsigned long copy_from_user_rc;
 	struct sharp_overlay_t ov;
 	size_t pixel_count;
+	void *storage;
+	int id;
 
 	if (copy_from_user(&ov, add->in_overlay, sizeof(ov))) {
 		printk(KERN_ERR "sharp_drm: failed to copy overlay descriptor from userspace\n");
@@ -46,6 +204,12 @@ int sharp_memory_ioctl_ov_add(struct drm_device *dev,
 		return -EINVAL;
 	}
 
+	// Checked again once the overlay is added, this only avoids copying
+	// buffers that can't fit
+	if (pixel_count > SHARP_MEMORY_FILE_OVERLAY_BYTES) {
+		return -ENOSPC;
+	}
+
 	// Copy pixel buffer from userspace
 	if ((pixels = (unsigned char*)kmalloc(pixel_count, GFP_KERNEL)) == NULL) {
 		printk(KERN_ERR "sharp_drm: failed to allocate overlay buffer\n");
@@ -58,21 +222,71 @@ int sharp_memory_ioctl_ov_add(struct drm_device *dev,
 		return -EFAULT;
 	}
 
+	mutex_lock(&priv->lock);
+
+	if (priv->overlay_bytes + pixel_count > SHARP_MEMORY_FILE_OVERLAY_BYTES) {
+		id = -ENOSPC;
+		goto out_unlock;
+	}
+
 	// Add overlay (copies `pixels`)
-	add->out_storage = drm_add_overlay(ov.x, ov.y, ov.width, ov.height,
-		pixels);
+	storage = drm_add_overlay(priv, ov.x, ov.y, ov.width, ov.height, pixels);
+	if (!storage) {
+		id = -ENOMEM;
+		goto out_unlock;
+	}
+
+	id = idr_alloc(&priv->overlays, storage, 1, 0, GFP_KERNEL);
+	if (id < 0) {
+		drm_remove_overlay(storage);
+		goto out_unlock;
+	}
+
+	priv->overlay_bytes += pixel_count;
+	add->out_handle = id;
+
+out_unlock:
+	mutex_unlock(&priv->lock);
 	kfree(pixels);
 
-	return 0;
+	return (id < 0) ? id : 0;
 }
 
-int sharp_memory_ioctl_ov_rem(struct drm_device *dev, void *storage_,
+int sharp_memory_ioctl_ov_rem(struct drm_device *dev, void *handle_,
 	struct drm_file *file)
 {
-	struct sharp_memory_ioctl_ov_rem_t * storage
-		= (struct sharp_memory_ioctl_ov_rem_t *)storage_;
+	struct sharp_memory_ioctl_ov_rem_t *handle
+		= (struct sharp_memory_ioctl_ov_rem_t *)handle_;
+	struct sharp_memory_file *priv = file->driver_priv;
+	void *storage, *display;
+	int id;
+	bool hidden = false;
+
+	mutex_lock(&priv->lock);
+
+	storage = idr_remove(&priv->overlays, handle->handle);
+	if (!storage) {
+		mutex_unlock(&priv->lock);
+		return -ENOENT;
+	}
+
+	// Display handles of the overlay go with it
+	idr_for_each_entry(&priv->displays, display, id) {
+		if (drm_overlay_display_storage(display) == storage) {
+			idr_remove(&priv->displays, id);
+			drm_hide_overlay(display);
+			hidden = true;
+		}
+	}
+
+	priv->overlay_bytes -= drm_overlay_bytes(storage);
+	drm_remove_overlay(storage);
 
-	drm_remove_overlay(storage->storage);
+	mutex_unlock(&priv->lock);
+
+	if (hidden) {
+		drm_redraw_fb(dev, -1);
+	}
 
 	return 0;
 }
@@ -82,8 +296,33 @@ int sharp_memory_ioctl_ov_show(struct drm_device *dev,
 {
 	union sharp_memory_ioctl_ov_show_t *show
 		= (union sharp_memory_ioctl_ov_show_t *)in_storage_out_display;
+	struct sharp_memory_file *priv = file->driver_priv;
+	void *storage, *display;
+	int id;
 
-	show->out_display = drm_show_overlay(show->in_storage);
+	mutex_lock(&priv->lock);
+
+	storage = idr_find(&priv->overlays, show->in_handle);
+	if (!storage) {
+		mutex_unlock(&priv->lock);
+		return -ENOENT;
+	}
+
+	display = drm_show_overlay(storage);
+	if (!display) {
+		mutex_unlock(&priv->lock);
+		return -ENOMEM;
+	}
+
+	id = idr_alloc(&priv->displays, display, 1, 0, GFP_KERNEL);
+	if (id < 0) {
+		drm_hide_overlay(display);
+		mutex_unlock(&priv->lock);
+		return id;
+	}
+	show->out_display = id;
+
+	mutex_unlock(&priv->lock);
 
 	drm_redraw_fb(dev, -1);
 
@@ -95,18 +334,166 @@ int sharp_memory_ioctl_ov_hide(struct drm_device *dev, void *display_,
 {
 	struct sharp_memory_ioctl_ov_hide_t *display
 		= (struct sharp_memory_ioctl_ov_hide_t *)display_;
+	struct sharp_memory_file *priv = file->driver_priv;
+	void *entry;
 
-	drm_hide_overlay(display->display);
+	mutex_lock(&priv->lock);
+	entry = idr_remove(&priv->displays, display->display);
+	if (entry) {
+		drm_hide_overlay(entry);
+	}
+	mutex_unlock(&priv->lock);
+
+	if (!entry) {
+		return -ENOENT;
+	}
 
 	drm_redraw_fb(dev, -1);
 
 	return 0;
 }
 
+// Only clears overlays created through this file
 int sharp_memory_ioctl_ov_clear(struct drm_device *dev, void *_,
 	struct drm_file *file)
 {
-	drm_clear_overlays();
+	struct sharp_memory_file *priv = file->driver_priv;
+	bool hidden;
+
+	mutex_lock(&priv->lock);
+	hidden = sharp_memory_file_clear(priv);
+	mutex_unlock(&priv->lock);
+
+	if (hidden) {
+		drm_redraw_fb(dev, -1);
+	}
 
 	return 0;
 }
+
+int sharp_memory_ioctl_ov_update(struct drm_device *dev, void *update_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_ov_update_t *update
+		= (struct sharp_memory_ioctl_ov_update_t *)update_;
+	struct sharp_memory_file *priv = file->driver_priv;
+	unsigned char *pixels = NULL;
+	unsigned long copy_from_user_rc;
+	size_t pixel_count;
+	void *storage;
+	int rc;
+
+	if ((update->width <= 0) || (update->height <= 0) ||
+		check_mul_overflow((size_t)update->width, (size_t)update->height,
+			&pixel_count)) {
+		return -EINVAL;
+	}
+
+	if ((pixels = (unsigned char*)kmalloc(pixel_count, GFP_KERNEL)) == NULL) {
+		return -ENOMEM;
+	}
+	if ((copy_from_user_rc = copy_from_user(pixels, update->pixels, pixel_count))) {
+		printk(KERN_ERR "sharp_drm: failed to copy overlay buffer from userspace (could not copy %zu/%zu)\n",
+			copy_from_user_rc, pixel_count);
+		kfree(pixels);
+		return -EFAULT;
+	}
+
+	// Copies `pixels` into the overlay's own buffer. The file lock keeps
+	// the overlay from being removed meanwhile
+	mutex_lock(&priv->lock);
+	storage = idr_find(&priv->overlays, update->handle);
+	rc = (storage)
+		? drm_update_overlay(dev, storage, update->width, update->height,
+			pixels)
+		: -ENOENT;
+	mutex_unlock(&priv->lock);
+	kfree(pixels);
+
+	return rc;
+}
+
+int sharp_memory_ioctl_ov_add_text(struct drm_device *dev, void *add_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_ov_add_text_t *add
+		= (struct sharp_memory_ioctl_ov_add_text_t *)add_;
+	struct sharp_memory_file *priv = file->driver_priv;
+	void *storage;
+	int id;
+
+	// Strings are copied in with the arguments, unterminated ones are cut
+	add->font[SHARP_MEMORY_FONT_NAME_MAX - 1] = '\0';
+	add->text[SHARP_MEMORY_TEXT_MAX - 1] = '\0';
+
+	mutex_lock(&priv->lock);
+
+	storage = drm_add_text(priv, add->x, add->y, add->font, add->flags,
+		add->text);
+	if (IS_ERR(storage)) {
+		id = PTR_ERR(storage);
+		goto out_unlock;
+	}
+
+	if (priv->overlay_bytes + drm_overlay_bytes(storage)
+	  > SHARP_MEMORY_FILE_OVERLAY_BYTES) {
+		drm_remove_overlay(storage);
+		id = -ENOSPC;
+		goto out_unlock;
+	}
+
+	id = idr_alloc(&priv->overlays, storage, 1, 0, GFP_KERNEL);
+	if (id < 0) {
+		drm_remove_overlay(storage);
+		goto out_unlock;
+	}
+
+	priv->overlay_bytes += drm_overlay_bytes(storage);
+	add->out_handle = id;
+
+out_unlock:
+	mutex_unlock(&priv->lock);
+
+	return (id < 0) ? id : 0;
+}
+
+// Only the new characters cross the syscall boundary
+int sharp_memory_ioctl_ov_set_text(struct drm_device *dev, void *set_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_ov_set_text_t *set
+		= (struct sharp_memory_ioctl_ov_set_text_t *)set_;
+	struct sharp_memory_file *priv = file->driver_priv;
+	void *storage;
+	int rc;
+
+	set->text[SHARP_MEMORY_TEXT_MAX - 1] = '\0';
+
+	mutex_lock(&priv->lock);
+	storage = idr_find(&priv->overlays, set->handle);
+	rc = (storage)
+		? drm_set_text(dev, storage, set->text)
+		: -ENOENT;
+	mutex_unlock(&priv->lock);
+
+	return rc;
+}
+
+int sharp_memory_ioctl_ov_move(struct drm_device *dev, void *move_,
+	struct drm_file *file)
+{
+	struct sharp_memory_ioctl_ov_move_t *move
+		= (struct sharp_memory_ioctl_ov_move_t *)move_;
+	struct sharp_memory_file *priv = file->driver_priv;
+	void *storage;
+	int rc;
+
+	mutex_lock(&priv->lock);
+	storage = idr_find(&priv->overlays, move->handle);
+	rc = (storage)
+		? drm_move_overlay(dev, storage, move->x, move->y)
+		: -ENOENT;
+	mutex_unlock(&priv->lock);
+
+	return rc;
+}
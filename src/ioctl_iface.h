@@ -1,43 +1,132 @@
 #ifndef IOCTL_IFACE_H_
 #define IOCTL_IFACE_H_
 
+#include "mono_convert.h"
+
 int ioctl_probe(void);
 void ioctl_remove(void);
 
-struct sharp_overlay_t
-{
-	int x, y, width, height;
-	unsigned char const *pixels;
-};
+int ioctl_open(struct drm_device *dev, struct drm_file *file);
+void ioctl_postclose(struct drm_device *dev, struct drm_file *file);
 
+// Overlay and display handles are only valid on the DRM file that created
+// them. Everything a file created is removed when it is closed
 union sharp_memory_ioctl_ov_add_t
 {
 	struct sharp_overlay_t *in_overlay;
-	void *out_storage;
+	unsigned int out_handle;
 };
 
 struct sharp_memory_ioctl_ov_rem_t
 {
-	void *storage;
+	unsigned int handle;
 };
 
 union sharp_memory_ioctl_ov_show_t
 {
-	void *in_storage;
-	void *out_display;
+	unsigned int in_handle;
+	unsigned int out_display;
 };
 
 struct sharp_memory_ioctl_ov_hide_t
 {
-	void *display;
+	unsigned int display;
+};
+
+// Replace overlay pixels in place, dimensions must match the overlay
+struct sharp_memory_ioctl_ov_update_t
+{
+	unsigned int handle;
+	int width, height;
+	unsigned char const *pixels;
+};
+
+struct sharp_memory_ioctl_ov_move_t
+{
+	unsigned int handle;
+	int x, y;
+};
+
+// Text overlays draw `text` with a built-in console font named by `font`,
+// such as "VGA8x8" or "VGA8x16", see `SHARP_TEXT_*` for `flags`. Strings
+// end at the first NUL. The handle works with all overlay ioctls except
+// `DRM_IOCTL_SHARP_OV_UPDATE`
+#define SHARP_MEMORY_FONT_NAME_MAX 32
+#define SHARP_MEMORY_TEXT_MAX 128
+
+struct sharp_memory_ioctl_ov_add_text_t
+{
+	int x, y;
+	unsigned int flags;
+	char font[SHARP_MEMORY_FONT_NAME_MAX];
+	char text[SHARP_MEMORY_TEXT_MAX];
+	unsigned int out_handle;
+};
+
+struct sharp_memory_ioctl_ov_set_text_t
+{
+	unsigned int handle;
+	char text[SHARP_MEMORY_TEXT_MAX];
+};
+
+// Overlay pixel bytes a single DRM file can hold
+#define SHARP_MEMORY_FILE_OVERLAY_BYTES (1024 * 1024)
+
+// Wire buffer holds `out_height` lines of `out_pitch` bytes each:
+// line address, `out_width / 8` pixel bytes, trailer.
+// Map with mmap(2) on the DRM file at `out_offset`
+struct sharp_memory_ioctl_wire_map_t
+{
+	unsigned int out_handle;
+	unsigned int out_size;
+	unsigned int out_pitch;
+	unsigned int out_width;
+	unsigned int out_height;
+	unsigned int pad;
+	unsigned long long out_offset;
+};
+
+// Send wire buffer lines [y1, y2)
+struct sharp_memory_ioctl_wire_flush_t
+{
+	int y1, y2;
+};
+
+#define SHARP_MEMORY_MAX_LINES 512
+
+// Bit `n % 64` of `lines[n / 64]` set to redraw framebuffer row `n`
+struct sharp_memory_ioctl_redraw_lines_t
+{
+	unsigned long long lines[SHARP_MEMORY_MAX_LINES / 64];
+};
+
+// Return a sync_file in `out_fence_fd` that signals once the redrawn
+// lines have been sent to the panel, instead of waiting for the transfer
+#define SHARP_MEMORY_REDRAW_OUT_FENCE (1 << 0)
+
+// Redraw framebuffer rows covered by [x1, x2) x [y1, y2)
+struct sharp_memory_ioctl_redraw_rect_t
+{
+	int x1, y1, x2, y2;
+	unsigned int flags;
+	int out_fence_fd;
 };
 
 int sharp_memory_ioctl_redraw(struct drm_device *dev, void *,
 	struct drm_file *file);
+int sharp_memory_ioctl_redraw_rect(struct drm_device *dev, void *rect,
+	struct drm_file *file);
+int sharp_memory_ioctl_redraw_lines(struct drm_device *dev, void *lines,
+	struct drm_file *file);
+
+int sharp_memory_ioctl_wire_map(struct drm_device *dev, void *map,
+	struct drm_file *file);
+int sharp_memory_ioctl_wire_flush(struct drm_device *dev, void *flush,
+	struct drm_file *file);
 
 int sharp_memory_ioctl_ov_add(struct drm_device *dev, \
 	void *in_overlay_out_storage, struct drm_file *file);
-int sharp_memory_ioctl_ov_rem(struct drm_device *dev, void *storage,
+int sharp_memory_ioctl_ov_rem(struct drm_device *dev, void *handle,
 	struct drm_file *file);
 int sharp_memory_ioctl_ov_show(struct drm_device *dev, \
 	void *in_storage_out_display, struct drm_file *file);
@@ -45,20 +134,47 @@ int sharp_memory_ioctl_ov_hide(struct drm_device *dev, void *display,
 	struct drm_file *file);
 int sharp_memory_ioctl_ov_clear(struct drm_device *dev, void *,
 	struct drm_file *file);
+int sharp_memory_ioctl_ov_update(struct drm_device *dev, void *update,
+	struct drm_file *file);
+int sharp_memory_ioctl_ov_move(struct drm_device *dev, void *move,
+	struct drm_file *file);
+int sharp_memory_ioctl_ov_add_text(struct drm_device *dev, void *add,
+	struct drm_file *file);
+int sharp_memory_ioctl_ov_set_text(struct drm_device *dev, void *set,
+	struct drm_file *file);
 
 // No parameters, callable from kernel space
 #define DRM_SHARP_REDRAW 0x00
 
+// Parameters without pointers, callable from kernel space
+#define DRM_SHARP_REDRAW_LINES 0x01
+#define DRM_SHARP_REDRAW_RECT 0x02
+
 // Parameters, must call from userspace
 #define DRM_SHARP_OV_ADD 0x10
 #define DRM_SHARP_OV_REM 0x11
 #define DRM_SHARP_OV_SHOW 0x12
 #define DRM_SHARP_OV_HIDE 0x13
 #define DRM_SHARP_OV_CLEAR 0x14
+#define DRM_SHARP_OV_UPDATE 0x15
+#define DRM_SHARP_OV_MOVE 0x16
+#define DRM_SHARP_OV_ADD_TEXT 0x17
+#define DRM_SHARP_OV_SET_TEXT 0x18
+
+#define DRM_SHARP_WIRE_MAP 0x20
+#define DRM_SHARP_WIRE_FLUSH 0x21
 
 #define DRM_IOCTL_SHARP_REDRAW \
 	DRM_IO(DRM_COMMAND_BASE + DRM_SHARP_REDRAW)
 
+#define DRM_IOCTL_SHARP_REDRAW_LINES \
+	DRM_IOW(DRM_COMMAND_BASE + DRM_SHARP_REDRAW_LINES, \
+		struct sharp_memory_ioctl_redraw_lines_t)
+
+#define DRM_IOCTL_SHARP_REDRAW_RECT \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_SHARP_REDRAW_RECT, \
+		struct sharp_memory_ioctl_redraw_rect_t)
+
 #define DRM_IOCTL_SHARP_OV_ADD \
 	DRM_IOWR(DRM_COMMAND_BASE + DRM_SHARP_OV_ADD, \
 		union sharp_memory_ioctl_ov_add_t)
@@ -73,9 +189,32 @@ int sharp_memory_ioctl_ov_clear(struct drm_device *dev, void *,
 		struct sharp_memory_ioctl_ov_hide_t)
 #define DRM_IOCTL_SHARP_OV_CLEAR \
 	DRM_IO(DRM_COMMAND_BASE + DRM_SHARP_OV_CLEAR)
+#define DRM_IOCTL_SHARP_OV_UPDATE \
+	DRM_IOW(DRM_COMMAND_BASE + DRM_SHARP_OV_UPDATE, \
+		struct sharp_memory_ioctl_ov_update_t)
+#define DRM_IOCTL_SHARP_OV_MOVE \
+	DRM_IOW(DRM_COMMAND_BASE + DRM_SHARP_OV_MOVE, \
+		struct sharp_memory_ioctl_ov_move_t)
+#define DRM_IOCTL_SHARP_OV_ADD_TEXT \
+	DRM_IOWR(DRM_COMMAND_BASE + DRM_SHARP_OV_ADD_TEXT, \
+		struct sharp_memory_ioctl_ov_add_text_t)
+#define DRM_IOCTL_SHARP_OV_SET_TEXT \
+	DRM_IOW(DRM_COMMAND_BASE + DRM_SHARP_OV_SET_TEXT, \
+		struct sharp_memory_ioctl_ov_set_text_t)
+
+#define DRM_IOCTL_SHARP_WIRE_MAP \
+	DRM_IOR(DRM_COMMAND_BASE + DRM_SHARP_WIRE_MAP, \
+		struct sharp_memory_ioctl_wire_map_t)
+#define DRM_IOCTL_SHARP_WIRE_FLUSH \
+	DRM_IOW(DRM_COMMAND_BASE + DRM_SHARP_WIRE_FLUSH, \
+		struct sharp_memory_ioctl_wire_flush_t)
 
 #define DRM_IOCTL_DEF_DRV_REDRAW \
 	DRM_IOCTL_DEF_DRV(SHARP_REDRAW, sharp_memory_ioctl_redraw, DRM_RENDER_ALLOW)
+#define DRM_IOCTL_DEF_DRV_REDRAW_LINES \
+	DRM_IOCTL_DEF_DRV(SHARP_REDRAW_LINES, sharp_memory_ioctl_redraw_lines, DRM_RENDER_ALLOW)
+#define DRM_IOCTL_DEF_DRV_REDRAW_RECT \
+	DRM_IOCTL_DEF_DRV(SHARP_REDRAW_RECT, sharp_memory_ioctl_redraw_rect, DRM_RENDER_ALLOW)
 
 #define DRM_IOCTL_DEF_DRV_OV_ADD \
 	DRM_IOCTL_DEF_DRV(SHARP_OV_ADD, sharp_memory_ioctl_ov_add, DRM_RENDER_ALLOW)
@@ -87,5 +226,18 @@ int sharp_memory_ioctl_ov_clear(struct drm_device *dev, void *,
 	DRM_IOCTL_DEF_DRV(SHARP_OV_HIDE, sharp_memory_ioctl_ov_hide, DRM_RENDER_ALLOW)
 #define DRM_IOCTL_DEF_DRV_OV_CLEAR \
 	DRM_IOCTL_DEF_DRV(SHARP_OV_CLEAR, sharp_memory_ioctl_ov_clear, DRM_RENDER_ALLOW)
+#define DRM_IOCTL_DEF_DRV_OV_UPDATE \
+	DRM_IOCTL_DEF_DRV(SHARP_OV_UPDATE, sharp_memory_ioctl_ov_update, DRM_RENDER_ALLOW)
+#define DRM_IOCTL_DEF_DRV_OV_MOVE \
+	DRM_IOCTL_DEF_DRV(SHARP_OV_MOVE, sharp_memory_ioctl_ov_move, DRM_RENDER_ALLOW)
+#define DRM_IOCTL_DEF_DRV_OV_ADD_TEXT \
+	DRM_IOCTL_DEF_DRV(SHARP_OV_ADD_TEXT, sharp_memory_ioctl_ov_add_text, DRM_RENDER_ALLOW)
+#define DRM_IOCTL_DEF_DRV_OV_SET_TEXT \
+	DRM_IOCTL_DEF_DRV(SHARP_OV_SET_TEXT, sharp_memory_ioctl_ov_set_text, DRM_RENDER_ALLOW)
+
+#define DRM_IOCTL_DEF_DRV_WIRE_MAP \
+	DRM_IOCTL_DEF_DRV(SHARP_WIRE_MAP, sharp_memory_ioctl_wire_map, DRM_RENDER_ALLOW)
+#define DRM_IOCTL_DEF_DRV_WIRE_FLUSH \
+	DRM_IOCTL_DEF_DRV(SHARP_WIRE_FLUSH, sharp_memory_ioctl_wire_flush, DRM_RENDER_ALLOW)
 
 #endif
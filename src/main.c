@@ -5,8 +5,10 @@
  * Copyright 2023 Andrew D'Angelo
  */
 
+#include <linux/err.h>
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/pm_runtime.h>
 #include <linux/spi/spi.h>
 
 #include "drm_iface.h"
@@ -45,7 +47,7 @@ static int sharp_memory_probe(struct spi_device *spi)
 
 static void sharp_memory_remove(struct spi_device *spi)
 {
-	drm_clear_overlays();
+	drm_clear_overlays(NULL);
 
 	ioctl_remove();
 	params_remove();
@@ -57,9 +59,25 @@ static void sharp_memory_shutdown(struct spi_device *spi)
 	sharp_memory_remove(spi);
 }
 
+static int sharp_memory_pm_suspend(struct device *dev)
+{
+	return drm_pm_suspend(dev_get_drvdata(dev));
+}
+
+static int sharp_memory_pm_resume(struct device *dev)
+{
+	return drm_pm_resume(dev_get_drvdata(dev));
+}
+
+// The device is runtime active while the panel is powered. System sleep
+// parks an active panel through the runtime callbacks
+static DEFINE_RUNTIME_DEV_PM_OPS(sharp_memory_pm_ops,
+	sharp_memory_pm_suspend, sharp_memory_pm_resume, NULL);
+
 static struct spi_driver sharp_memory_spi_driver = {
 	.driver = {
 		.name = "sharp-drm",
+		.pm = pm_ptr(&sharp_memory_pm_ops),
 	},
 	.probe = sharp_memory_probe,
 	.remove = sharp_memory_remove,
@@ -138,10 +156,17 @@ void sharp_memory_set_invert(int setting)
 }
 EXPORT_SYMBOL_GPL(sharp_memory_set_invert);
 
+// Bit `n` of `lines` set to redraw framebuffer row `n`
+int sharp_memory_redraw_lines(unsigned long const *lines, int nbits)
+{
+	return drm_redraw_lines(drm_default_device(), lines, nbits);
+}
+EXPORT_SYMBOL_GPL(sharp_memory_redraw_lines);
+
 void* sharp_memory_add_overlay(int x, int y, int width, int height,
 	unsigned char const* pixels)
 {
-	return drm_add_overlay(x, y, width, height, pixels);
+	return drm_add_overlay(NULL, x, y, width, height, pixels);
 }
 EXPORT_SYMBOL_GPL(sharp_memory_add_overlay);
 
@@ -163,9 +188,67 @@ void sharp_memory_hide_overlay(void* display)
 }
 EXPORT_SYMBOL_GPL(sharp_memory_hide_overlay);
 
+// `pixels` must have the dimensions the overlay was added with
+int sharp_memory_update_overlay(void* storage, int width, int height,
+	unsigned char const* pixels)
+{
+	return drm_update_overlay(drm_default_device(), storage, width, height,
+		pixels);
+}
+EXPORT_SYMBOL_GPL(sharp_memory_update_overlay);
+
+int sharp_memory_move_overlay(void* storage, int x, int y)
+{
+	return drm_move_overlay(drm_default_device(), storage, x, y);
+}
+EXPORT_SYMBOL_GPL(sharp_memory_move_overlay);
+
+// Text overlays are shown, hidden, moved and removed like other overlays.
+// `font` names a built-in console font such as "VGA8x8", see
+// `SHARP_TEXT_*` in mono_convert.h for `flags`. NULL on failure, for
+// example if the font isn't built into the kernel
+void* sharp_memory_add_text(int x, int y, char const* font, int flags,
+	char const* text)
+{
+	void *storage = drm_add_text(NULL, x, y, font, flags, text);
+
+	return (IS_ERR(storage)) ? NULL : storage;
+}
+EXPORT_SYMBOL_GPL(sharp_memory_add_text);
+
+int sharp_memory_set_text(void* storage, char const* text)
+{
+	return drm_set_text(drm_default_device(), storage, text);
+}
+EXPORT_SYMBOL_GPL(sharp_memory_set_text);
+
+// Indicators are small overlays for input state such as modifier keys.
+// `sharp_memory_show_indicator` can be called from any context, including
+// interrupt handlers, and sends only the indicator lines ahead of queued
+// frames. Adding and removing may sleep
+void* sharp_memory_add_indicator(int x, int y, int width, int height,
+	unsigned char const* pixels)
+{
+	return drm_add_indicator(x, y, width, height, pixels);
+}
+EXPORT_SYMBOL_GPL(sharp_memory_add_indicator);
+
+void sharp_memory_remove_indicator(void* indicator)
+{
+	drm_remove_indicator(drm_default_device(), indicator);
+}
+EXPORT_SYMBOL_GPL(sharp_memory_remove_indicator);
+
+void sharp_memory_show_indicator(void* indicator, bool show)
+{
+	drm_show_indicator(drm_default_device(), indicator, show);
+}
+EXPORT_SYMBOL_GPL(sharp_memory_show_indicator);
+
+// Only overlays added through this API, DRM files clear their own
 void sharp_memory_clear_overlays(void)
 {
-	drm_clear_overlays();
+	drm_clear_overlays(NULL);
 }
 EXPORT_SYMBOL_GPL(sharp_memory_clear_overlays);
 
@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Grayscale to tagged mono line conversion for the Sharp Memory LCD
+ *
+ * Built into the driver and into the host-side replay tool, so that
+ * benchmarks run the same pixel code as the panel.
+ */
+
+#ifdef __KERNEL__
+#include <linux/minmax.h>
+#include <linux/string.h>
+#else
+#include <string.h>
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#include "mono_convert.h"
+
+// 4x4 Bayer matrix
+static const u8 sharp_memory_bayer[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+// Per-pixel thresholds for a 4x4 tile. Ordered dithering spreads the
+// thresholds around the cutoff so that it still sets the overall level
+void sharp_memory_thresholds(struct sharp_memory_profile const *profile,
+	int thresholds[4][4])
+{
+	int x, y;
+
+	for (y = 0; y < 4; y++) {
+		for (x = 0; x < 4; x++) {
+			if (profile->dither == SHARP_MEMORY_DITHER_ORDERED) {
+				thresholds[y][x] = min(255,
+					((sharp_memory_bayer[y][x] * 2 + 1) * profile->cutoff) / 16);
+			} else {
+				thresholds[y][x] = profile->cutoff;
+			}
+		}
+	}
+}
+
+// Convert `height` rows of `width` gray bytes from `src` to tagged mono
+// lines in `dst`. Each tagged line is never longer than its source row,
+// so `dst` may be the same buffer as `src`
+size_t sharp_memory_gray8_to_mono_tagged(u8 *dst, u8 const *src,
+	int width, int height, int y0, struct sharp_memory_profile const *profile)
+{
+	int line, b8, b1;
+	unsigned char d;
+	int const tagged_line_len = 2 + width / 8;
+	int thresholds[4][4];
+	int const *row_thresholds;
+
+	sharp_memory_thresholds(profile, thresholds);
+
+	// Iterate over lines from [0, height)
+	for (line = 0; line < height; line++) {
+
+		// Dither pattern is anchored to panel lines
+		row_thresholds = thresholds[y0 & 3];
+
+		// Iterate over chunks of 8 source grayscale bytes
+		// Each 8-byte source chunk will map to one destination mono byte
+		for (b8 = 0; b8 < width; b8 += 8) {
+			d = 0;
+
+			// Iterate over each of the 8 grayscale bytes in the chunk
+			// Build up the destination mono byte
+			for (b1 = 0; b1 < 8; b1++) {
+
+				// Change at what gray level the mono pixel is active here
+				if (src[(line * width) + b8 + b1] >= row_thresholds[b1 & 3]) {
+					d |= 0b10000000 >> b1;
+				}
+			}
+
+			// Without the line number and trailer tags, each destination
+			// mono line would have a length `width / 8`. However, we are
+			// inserting the line number at the beginning of the line and
+			// the zero-byte trailer at the end.
+			// So the destination mono line is at index
+			// `line * tagged_line_len = line * (2 + width / 8)`
+			// The destination mono byte is offset by 1 to make room for
+			// the line tag, written at the end of converting the current
+			// line.
+			dst[(line * tagged_line_len) + 1 + (b8 / 8)] = d;
+		}
+
+		// Write the line number and trailer tags
+		dst[line * tagged_line_len] = sharp_memory_reverse_byte((u8)(y0 + 1)); // Indexed from 1
+		dst[(line * tagged_line_len) + tagged_line_len - 1] = 0;
+		y0++;
+	}
+
+	return height * tagged_line_len;
+}
+
+// Same as `sharp_memory_gray8_to_mono_tagged`, but each source pixel is
+// expanded to 2x2 panel pixels. Each source row of `width` gray bytes
+// produces two tagged lines of `2 + 2 * width / 8` bytes, which is never
+// longer than the source row, so the conversion can still run in-place.
+// `y0` is the first destination panel line.
+size_t sharp_memory_gray8_to_mono_tagged_2x(u8 *dst, u8 const *src,
+	int width, int height, int y0, struct sharp_memory_profile const *profile)
+{
+	int line, b4, b1;
+	unsigned char d;
+	u8 *out;
+	int const tagged_line_len = 2 + (2 * width) / 8;
+	int thresholds[4][4];
+	int const *row_thresholds;
+
+	sharp_memory_thresholds(profile, thresholds);
+
+	// Iterate over source lines from [0, height)
+	for (line = 0; line < height; line++) {
+
+		// Destination lines are written two at a time
+		out = &dst[line * 2 * tagged_line_len];
+
+		// Dither pattern is anchored to framebuffer rows
+		row_thresholds = thresholds[(y0 / 2) & 3];
+
+		// Each 4-byte source chunk maps to one destination mono byte
+		for (b4 = 0; b4 < width; b4 += 4) {
+			d = 0;
+
+			for (b1 = 0; b1 < 4; b1++) {
+				if (src[(line * width) + b4 + b1] >= row_thresholds[b1]) {
+					d |= 0b11000000 >> (b1 * 2);
+				}
+			}
+
+			// Source bytes up to `b4 + 4` have been read, and the
+			// destination index never passes them
+			out[1 + (b4 / 4)] = d;
+		}
+
+		// Tag the first line, then emit the second copy with its own tag
+		out[0] = sharp_memory_reverse_byte((u8)(y0 + 1)); // Indexed from 1
+		out[tagged_line_len - 1] = 0;
+		memcpy(&out[tagged_line_len], out, tagged_line_len);
+		out[tagged_line_len] = sharp_memory_reverse_byte((u8)(y0 + 2));
+		y0 += 2;
+	}
+
+	return height * 2 * tagged_line_len;
+}
+
+// Draw one overlay onto tagged mono lines [y1, y2) of a `width` x
+// `height` panel. Negative overlay positions count from the right and
+// bottom edges
+void sharp_memory_draw_overlay(u8 *buf, int width, int height, int y1, int y2,
+	struct sharp_overlay_t const *ov, int cutoff)
+{
+	sharp_memory_draw_overlay_keyed(buf, width, height, y1, y2, ov, cutoff, -1);
+}
+
+// Same, but overlay pixels equal to `key` leave the line untouched.
+// -1 draws every pixel
+void sharp_memory_draw_overlay_keyed(u8 *buf, int width, int height,
+	int y1, int y2, struct sharp_overlay_t const *ov, int cutoff, int key)
+{
+	int x, y, sx, sy, px, on, gray;
+	int const tagged_line_len = 2 + width / 8;
+	u8 *line;
+
+	x = (ov->x < 0) ? (width + ov->x) : ov->x;
+	y = (ov->y < 0) ? (height + ov->y) : ov->y;
+
+	// Any overlap?
+	if (((y + ov->height) <= y1) || (y2 <= y)) {
+		return;
+	}
+
+	// Draw overlay pixels
+	for (sy = 0; sy < ov->height; sy++) {
+
+		// Skip lines before clip
+		if ((y + sy) < y1) {
+			continue;
+		// Exit if reached end of clip
+		} else if (y2 <= (y + sy)) {
+			break;
+		}
+
+		// Skip line number tag
+		line = &buf[(y + sy - y1) * tagged_line_len + 1];
+
+		for (sx = 0; sx < ov->width; sx++) {
+
+			px = x + sx;
+			if ((px < 0) || (width <= px)) {
+				continue;
+			}
+
+			gray = ov->pixels[(sy * ov->width) + sx];
+			if (gray == key) {
+				continue;
+			}
+
+			// Same threshold as framebuffer pixels
+			on = (gray >= cutoff);
+			sharp_memory_mono_set_pixel(line, px, on);
+		}
+	}
+}
+
+// Apply 8 pixels starting at `px` to the pixel bytes of one panel line:
+// bits under `mask` are cleared with AND, then set from `image` with XOR.
+// Unless aligned, they straddle two panel bytes
+static void sharp_memory_draw_bits(u8 *line, int width, int px, u8 mask,
+	u8 image)
+{
+	int b, shift;
+	int const line_bytes = width / 8;
+
+	if (!mask || (px <= -8)) {
+		return;
+	}
+
+	b = (px < 0) ? -1 : (px / 8);
+	shift = ((px % 8) + 8) % 8;
+
+	if ((0 <= b) && (b < line_bytes)) {
+		line[b] = (line[b] & ~(mask >> shift)) ^ (image >> shift);
+	}
+	if (shift && (b + 1 < line_bytes)) {
+		line[b + 1] = (line[b + 1] & ~(u8)(mask << (8 - shift)))
+			^ (u8)(image << (8 - shift));
+	}
+}
+
+// Draw a cursor onto tagged mono lines [y1, y2) of a `width` pixel wide
+// panel, a byte at a time
+void sharp_memory_draw_cursor(u8 *buf, int width, int y1, int y2,
+	struct sharp_cursor_t const *cur)
+{
+	int y, sb;
+	int const tagged_line_len = 2 + width / 8;
+	u8 const *mask, *image;
+	u8 *line;
+
+	for (y = max(y1, cur->y); y < min(y2, cur->y + cur->height); y++) {
+
+		// Skip line number tag
+		line = &buf[(y - y1) * tagged_line_len + 1];
+		mask = &cur->mask[(y - cur->y) * cur->pitch];
+		image = &cur->image[(y - cur->y) * cur->pitch];
+
+		for (sb = 0; sb < cur->pitch; sb++) {
+			sharp_memory_draw_bits(line, width, cur->x + (sb * 8),
+				mask[sb], image[sb]);
+		}
+	}
+}
+
+// Draw text onto tagged mono lines [y1, y2) of a `width` x `height` panel,
+// one glyph cell per character from the overlay position. Font rows are
+// packed like panel lines, so glyphs are drawn straight from the font a
+// byte at a time. Negative positions count from the right and bottom edges
+void sharp_memory_draw_text(u8 *buf, int width, int height, int y1, int y2,
+	struct sharp_overlay_t const *ov, struct sharp_text_t const *text)
+{
+	int x, y, i, b, row, px;
+	int const tagged_line_len = 2 + width / 8;
+	int const pitch = (text->glyph_width + 7) / 8;
+	u8 const *glyph;
+	u8 cell, bits, mask, image;
+	u8 *line;
+
+	x = (ov->x < 0) ? (width + ov->x) : ov->x;
+	y = (ov->y < 0) ? (height + ov->y) : ov->y;
+
+	for (row = max(y1 - y, 0); row < min(y2 - y, text->glyph_height); row++) {
+
+		// Skip line number tag
+		line = &buf[(y + row - y1) * tagged_line_len + 1];
+
+		for (i = 0; i < text->len; i++) {
+			glyph = &text->glyphs[((text->chars[i] * text->glyph_height) + row)
+				* pitch];
+
+			for (b = 0; b < pitch; b++) {
+				px = x + (i * text->glyph_width) + (b * 8);
+				if (px >= width) {
+					break;
+				}
+
+				// Font rows are padded to whole bytes
+				cell = ((b == pitch - 1) && (text->glyph_width % 8))
+					? (u8)(0xff << (8 - (text->glyph_width % 8)))
+					: 0xff;
+				bits = glyph[b] & cell;
+
+				mask = (text->flags & SHARP_TEXT_TRANSPARENT) ? bits : cell;
+				image = (text->flags & SHARP_TEXT_WHITE) ? bits : (mask & ~bits);
+				sharp_memory_draw_bits(line, width, px, mask, image);
+			}
+		}
+	}
+}
@@ -0,0 +1,91 @@
+#ifndef MONO_CONVERT_H_
+#define MONO_CONVERT_H_
+
+// Pixel conversion shared by the driver and the host-side tools in
+// `tools/`, so nothing here may depend on kernel APIs
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+typedef uint8_t u8;
+#endif
+
+// Mono conversion settings, snapshot once per conversion or transfer
+struct sharp_memory_profile
+{
+	int cutoff;
+	int invert;
+	int dither;
+};
+
+#define SHARP_MEMORY_DITHER_NONE 0
+#define SHARP_MEMORY_DITHER_ORDERED 1
+
+// Gray overlay pixels, thresholded like framebuffer pixels
+struct sharp_overlay_t
+{
+	int x, y, width, height;
+	unsigned char const *pixels;
+};
+
+// Cursor image packed like panel lines, MSB first, `pitch` bytes per row.
+// Pixels set in `mask` are replaced by the matching `image` bit
+struct sharp_cursor_t
+{
+	int x, y, width, height, pitch;
+	u8 const *mask, *image;
+};
+
+// Text drawn from a console font: `glyph_height` rows per glyph, each
+// padded to whole bytes, MSB first. Glyphs are black on white unless
+// `SHARP_TEXT_WHITE`, and `SHARP_TEXT_TRANSPARENT` leaves the pixels
+// around them untouched
+struct sharp_text_t
+{
+	int glyph_width, glyph_height;
+	u8 const *glyphs;
+	unsigned char const *chars;
+	int len;
+	int flags;
+};
+
+#define SHARP_TEXT_WHITE (1 << 0)
+#define SHARP_TEXT_TRANSPARENT (1 << 1)
+
+static inline u8 sharp_memory_reverse_byte(u8 b)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+static inline void sharp_memory_mono_set_pixel(u8 *line, int x, int on)
+{
+	if (on) {
+		line[x / 8] |= 0b10000000 >> (x % 8);
+	} else {
+		line[x / 8] &= ~(0b10000000 >> (x % 8));
+	}
+}
+
+void sharp_memory_thresholds(struct sharp_memory_profile const *profile,
+	int thresholds[4][4]);
+
+size_t sharp_memory_gray8_to_mono_tagged(u8 *dst, u8 const *src,
+	int width, int height, int y0, struct sharp_memory_profile const *profile);
+size_t sharp_memory_gray8_to_mono_tagged_2x(u8 *dst, u8 const *src,
+	int width, int height, int y0, struct sharp_memory_profile const *profile);
+
+void sharp_memory_draw_overlay(u8 *buf, int width, int height, int y1, int y2,
+	struct sharp_overlay_t const *ov, int cutoff);
+void sharp_memory_draw_overlay_keyed(u8 *buf, int width, int height,
+	int y1, int y2, struct sharp_overlay_t const *ov, int cutoff, int key);
+void sharp_memory_draw_cursor(u8 *buf, int width, int y1, int y2,
+	struct sharp_cursor_t const *cur);
+void sharp_memory_draw_text(u8 *buf, int width, int height, int y1, int y2,
+	struct sharp_overlay_t const *ov, struct sharp_text_t const *text);
+
+#endif
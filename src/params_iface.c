@@ -7,8 +7,15 @@
 
 int g_param_mono_cutoff = 32;
 int g_param_mono_invert = 0;
+int g_param_mono_dither = 0;
 int g_param_overlays = 1;
 int g_param_auto_clear = 1;
+int g_param_downscale = 0;
+int g_param_mono_fbdev = 0;
+int g_param_parallel_rows = 0;
+int g_param_shmem = 0;
+int g_param_handoff = 0;
+int g_param_interlace = 2;
 
 static int set_param_u8(const char *val, const struct kernel_param *kp)
 {
@@ -29,19 +36,60 @@ static const struct kernel_param_ops u8_param_ops = {
 	.get = param_get_int,
 };
 
-module_param_cb(mono_cutoff, &u8_param_ops, &g_param_mono_cutoff, 0660);
+// Conversion settings take effect on the cached image immediately
+static int set_param_mono_u8(const char *val, const struct kernel_param *kp)
+{
+	int rc;
+
+	if ((rc = set_param_u8(val, kp))) {
+		return rc;
+	}
+
+	drm_apply_params(drm_default_device());
+
+	return 0;
+}
+
+static const struct kernel_param_ops mono_u8_param_ops = {
+	.set = set_param_mono_u8,
+	.get = param_get_int,
+};
+
+module_param_cb(mono_cutoff, &mono_u8_param_ops, &g_param_mono_cutoff, 0660);
 MODULE_PARM_DESC(mono_cutoff,
 	"Greyscale value from 0-255 after which a mono pixel will be activated");
 
-module_param_cb(mono_invert, &u8_param_ops, &g_param_mono_invert, 0660);
+module_param_cb(mono_invert, &mono_u8_param_ops, &g_param_mono_invert, 0660);
 MODULE_PARM_DESC(mono_invert, "0 for no inversion, 1 for inversion");
 
+module_param_cb(mono_dither, &mono_u8_param_ops, &g_param_mono_dither, 0660);
+MODULE_PARM_DESC(mono_dither, "0 for plain cutoff, 1 for ordered dithering around the cutoff");
+
 module_param_cb(overlays, &u8_param_ops, &g_param_overlays, 0660);
 MODULE_PARM_DESC(overlays, "0 for no overlays, 1 for overlays");
 
 module_param_cb(auto_clear, &u8_param_ops, &g_param_auto_clear, 0660);
 MODULE_PARM_DESC(auto_clear, "0 to retain screen contents on driver unload, 1 to clear");
 
+// Read once at probe, the framebuffer size can't change after registration
+module_param_cb(downscale, &u8_param_ops, &g_param_downscale, 0444);
+MODULE_PARM_DESC(downscale, "0 for native resolution, 1 for half-resolution framebuffer doubled to 2x2 panel pixels");
+
+module_param_cb(mono_fbdev, &u8_param_ops, &g_param_mono_fbdev, 0444);
+MODULE_PARM_DESC(mono_fbdev, "0 for generic XRGB8888 fbdev emulation, 1 for native 1bpp fbdev");
+
+module_param_cb(shmem, &u8_param_ops, &g_param_shmem, 0444);
+MODULE_PARM_DESC(shmem, "0 for framebuffers in DMA memory, 1 for cached shmem pages");
+
+module_param_cb(handoff, &u8_param_ops, &g_param_handoff, 0444);
+MODULE_PARM_DESC(handoff, "0 to clear the panel when it is first enabled, 1 to keep its contents and finish setup asynchronously");
+
+module_param_cb(parallel_rows, &u8_param_ops, &g_param_parallel_rows, 0660);
+MODULE_PARM_DESC(parallel_rows, "0 to convert on one CPU, otherwise the number of framebuffer rows from which conversion is split across CPUs");
+
+module_param_cb(interlace, &u8_param_ops, &g_param_interlace, 0660);
+MODULE_PARM_DESC(interlace, "0 or 1 to always send whole frames, otherwise the number of line fields sent in turn while damage arrives faster than the bus can send it (up to 8)");
+
 int params_probe(void)
 {
 	return 0;
@@ -55,4 +103,5 @@ void params_remove(void)
 void params_set_mono_invert(int setting)
 {
 	g_param_mono_invert = setting;
+	drm_apply_params(drm_default_device());
 }
@@ -3,8 +3,15 @@
 
 extern int g_param_mono_cutoff;
 extern int g_param_mono_invert;
+extern int g_param_mono_dither;
 extern int g_param_overlays;
 extern int g_param_auto_clear;
+extern int g_param_downscale;
+extern int g_param_mono_fbdev;
+extern int g_param_parallel_rows;
+extern int g_param_shmem;
+extern int g_param_handoff;
+extern int g_param_interlace;
 
 int params_probe(void);
 void params_remove(void);
@@ -0,0 +1,42 @@
+#ifndef TRACE_FORMAT_H_
+#define TRACE_FORMAT_H_
+
+// Damage trace file format, written by the driver through debugfs and
+// read by `tools/replay`. All fields are little-endian, whatever the CPU
+// the trace was recorded on
+
+#include <linux/types.h>
+
+#define SHARP_MEMORY_TRACE_MAGIC 0x54444d53 // "SMDT"
+#define SHARP_MEMORY_TRACE_VERSION 1
+
+// Trace modes
+#define SHARP_MEMORY_TRACE_OFF 0
+#define SHARP_MEMORY_TRACE_RECTS 1
+#define SHARP_MEMORY_TRACE_CONTENTS 2
+
+// Start of every trace
+struct sharp_memory_trace_header
+{
+	__le32 magic;
+	__le16 version;
+	__le16 mode;
+	__le16 panel_width;
+	__le16 panel_height;
+	__le32 pad;
+};
+
+// One call to `sharp_memory_fb_dirty()`
+struct sharp_memory_trace_record
+{
+	__le64 time_ns;
+	__le16 x1, y1, x2, y2; // Signed
+	__le16 fb_width;
+	__le16 fb_height;
+
+	// Rows [y1, y2) of `fb_width` 8-bit gray pixels follow when set. Zero
+	// when contents were not recorded or were not available
+	__le32 data_len;
+};
+
+#endif
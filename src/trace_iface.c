@@ -0,0 +1,252 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Damage trace recorder for the Sharp Memory LCD
+ *
+ * Records every framebuffer damage rectangle, and optionally the gray
+ * pixels it covered, to `/sys/kernel/debug/sharp_drm/damage_trace`.
+ * Traces can be replayed on a host with `tools/replay` to benchmark
+ * pipeline changes against real workloads. See `trace_format.h`.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/sched/clock.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+
+#include "drm_iface.h"
+#include "trace_format.h"
+#include "trace_iface.h"
+
+// Records that don't fit are dropped rather than blocking the display
+#define SHARP_MEMORY_TRACE_SIZE (4 << 20)
+
+struct sharp_trace
+{
+	struct drm_device *drm;
+	struct dentry *dir;
+
+	// Mode and buffered records, protected by `lock`
+	struct mutex lock;
+	int mode;
+	struct kfifo fifo;
+	void *fifo_buf;
+	u32 dropped;
+
+	wait_queue_head_t wait;
+};
+
+static struct sharp_trace *g_trace = NULL;
+
+struct dentry *damage_trace_dir(void)
+{
+	return (g_trace) ? g_trace->dir : NULL;
+}
+
+int damage_trace_mode(void)
+{
+	return (g_trace) ? READ_ONCE(g_trace->mode) : SHARP_MEMORY_TRACE_OFF;
+}
+
+void damage_trace_record(struct drm_rect const *rect, int fb_width,
+	int fb_height, u8 const *gray)
+{
+	struct sharp_trace *trace = g_trace;
+	struct sharp_memory_trace_record record;
+	u32 data_len = 0;
+
+	if (!trace || (READ_ONCE(trace->mode) == SHARP_MEMORY_TRACE_OFF)) {
+		return;
+	}
+
+	record.time_ns = cpu_to_le64(local_clock());
+	record.x1 = cpu_to_le16((u16)rect->x1);
+	record.y1 = cpu_to_le16((u16)rect->y1);
+	record.x2 = cpu_to_le16((u16)rect->x2);
+	record.y2 = cpu_to_le16((u16)rect->y2);
+	record.fb_width = cpu_to_le16(fb_width);
+	record.fb_height = cpu_to_le16(fb_height);
+
+	mutex_lock(&trace->lock);
+
+	if (trace->mode == SHARP_MEMORY_TRACE_OFF) {
+		goto out_unlock;
+	}
+
+	if (gray && (trace->mode == SHARP_MEMORY_TRACE_CONTENTS)) {
+		data_len = (rect->y2 - rect->y1) * fb_width;
+	}
+	record.data_len = cpu_to_le32(data_len);
+
+	if (kfifo_avail(&trace->fifo) < sizeof(record) + data_len) {
+		trace->dropped++;
+		goto out_unlock;
+	}
+
+	kfifo_in(&trace->fifo, (u8 const *)&record, sizeof(record));
+	if (data_len) {
+		kfifo_in(&trace->fifo, gray, data_len);
+	}
+
+	wake_up_interruptible(&trace->wait);
+
+out_unlock:
+	mutex_unlock(&trace->lock);
+}
+
+// Blocks until records arrive, returns end of file once tracing is off
+// and everything has been read
+static ssize_t sharp_trace_read(struct file *file, char __user *buf,
+	size_t count, loff_t *ppos)
+{
+	struct sharp_trace *trace = file->private_data;
+	unsigned int copied;
+	int rc, off;
+
+	for (;;) {
+		mutex_lock(&trace->lock);
+		if (!kfifo_is_empty(&trace->fifo)) {
+			rc = kfifo_to_user(&trace->fifo, buf, count, &copied);
+			mutex_unlock(&trace->lock);
+			return (rc) ? rc : copied;
+		}
+		off = (trace->mode == SHARP_MEMORY_TRACE_OFF);
+		mutex_unlock(&trace->lock);
+
+		if (off) {
+			return 0;
+		}
+		if (file->f_flags & O_NONBLOCK) {
+			return -EAGAIN;
+		}
+
+		rc = wait_event_interruptible(trace->wait,
+			!kfifo_is_empty(&trace->fifo)
+			|| (READ_ONCE(trace->mode) == SHARP_MEMORY_TRACE_OFF));
+		if (rc) {
+			return rc;
+		}
+	}
+}
+
+static const struct file_operations sharp_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = simple_open,
+	.read = sharp_trace_read,
+};
+
+static int sharp_trace_mode_get(void *data, u64 *val)
+{
+	struct sharp_trace *trace = data;
+
+	*val = READ_ONCE(trace->mode);
+
+	return 0;
+}
+
+// Starting a trace discards anything unread and writes a new header
+static int sharp_trace_mode_set(void *data, u64 val)
+{
+	struct sharp_trace *trace = data;
+	struct sharp_memory_trace_header header;
+	int width, height;
+
+	if (val > SHARP_MEMORY_TRACE_CONTENTS) {
+		return -EINVAL;
+	}
+
+	mutex_lock(&trace->lock);
+
+	if ((trace->mode == SHARP_MEMORY_TRACE_OFF)
+	 && (val != SHARP_MEMORY_TRACE_OFF)) {
+		drm_panel_size(trace->drm, &width, &height);
+
+		header.magic = cpu_to_le32(SHARP_MEMORY_TRACE_MAGIC);
+		header.version = cpu_to_le16(SHARP_MEMORY_TRACE_VERSION);
+		header.mode = cpu_to_le16(val);
+		header.panel_width = cpu_to_le16(width);
+		header.panel_height = cpu_to_le16(height);
+		header.pad = 0;
+
+		kfifo_reset(&trace->fifo);
+		trace->dropped = 0;
+		kfifo_in(&trace->fifo, (u8 const *)&header, sizeof(header));
+	}
+
+	WRITE_ONCE(trace->mode, (int)val);
+
+	mutex_unlock(&trace->lock);
+
+	wake_up_interruptible(&trace->wait);
+
+	return 0;
+}
+
+DEFINE_DEBUGFS_ATTRIBUTE(sharp_trace_mode_fops, sharp_trace_mode_get,
+	sharp_trace_mode_set, "%llu\n");
+
+int damage_trace_probe(struct drm_device *drm)
+{
+	struct sharp_trace *trace;
+	int rc;
+
+	trace = kzalloc(sizeof(*trace), GFP_KERNEL);
+	if (!trace) {
+		return -ENOMEM;
+	}
+
+	trace->fifo_buf = vmalloc(SHARP_MEMORY_TRACE_SIZE);
+	if (!trace->fifo_buf) {
+		kfree(trace);
+		return -ENOMEM;
+	}
+
+	rc = kfifo_init(&trace->fifo, trace->fifo_buf, SHARP_MEMORY_TRACE_SIZE);
+	if (rc) {
+		vfree(trace->fifo_buf);
+		kfree(trace);
+		return rc;
+	}
+
+	trace->drm = drm;
+	trace->mode = SHARP_MEMORY_TRACE_OFF;
+	mutex_init(&trace->lock);
+	init_waitqueue_head(&trace->wait);
+
+	trace->dir = debugfs_create_dir("sharp_drm", NULL);
+	debugfs_create_file_unsafe("damage_trace_mode", 0600, trace->dir, trace,
+		&sharp_trace_mode_fops);
+	debugfs_create_file("damage_trace", 0400, trace->dir, trace,
+		&sharp_trace_fops);
+	debugfs_create_u32("damage_trace_dropped", 0400, trace->dir,
+		&trace->dropped);
+
+	g_trace = trace;
+
+	return 0;
+}
+
+void damage_trace_remove(void)
+{
+	struct sharp_trace *trace = g_trace;
+
+	if (!trace) {
+		return;
+	}
+
+	// Readers see end of file and leave
+	mutex_lock(&trace->lock);
+	g_trace = NULL;
+	WRITE_ONCE(trace->mode, SHARP_MEMORY_TRACE_OFF);
+	mutex_unlock(&trace->lock);
+	wake_up_interruptible(&trace->wait);
+
+	debugfs_remove_recursive(trace->dir);
+
+	vfree(trace->fifo_buf);
+	kfree(trace);
+}
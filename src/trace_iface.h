@@ -0,0 +1,20 @@
+#ifndef TRACE_IFACE_H_
+#define TRACE_IFACE_H_
+
+#include <drm/drm_device.h>
+#include <drm/drm_rect.h>
+
+int damage_trace_probe(struct drm_device *drm);
+void damage_trace_remove(void);
+
+// Debugfs directory for other driver statistics, NULL without a trace
+struct dentry *damage_trace_dir(void);
+
+// Current trace mode, recording is skipped when off
+int damage_trace_mode(void);
+
+// `gray` holds rows [rect->y1, rect->y2) of `fb_width` pixels, or NULL
+void damage_trace_record(struct drm_rect const *rect, int fb_width,
+	int fb_height, u8 const *gray);
+
+#endif
@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Replay a damage trace recorded from
+ * `/sys/kernel/debug/sharp_drm/damage_trace` through the driver's
+ * conversion and overlay code, and report what each frame costs.
+ *
+ * Every trace record is treated as one flush: the damaged rows are
+ * converted into a mono shadow, then the dirty lines are gathered with
+ * overlays and inversion applied, as the driver does before a transfer.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mono_convert.h"
+#include "trace_format.h"
+
+#define MAX_OVERLAYS 8
+
+struct replay_options
+{
+	long spi_hz;
+	int iterations;
+	struct sharp_memory_profile profile;
+	struct sharp_overlay_t overlays[MAX_OVERLAYS];
+	int num_overlays;
+};
+
+struct replay_stats
+{
+	long frames;
+	long frames_without_contents;
+	long lines;
+	long max_lines;
+	long bytes;
+	double cpu_ns;
+	double max_cpu_ns;
+	unsigned long long first_ns, last_ns;
+};
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-c spi_hz] [-t cutoff] [-d] [-i] [-n iterations]\n"
+		"          [-o x,y,w,h]... trace\n"
+		"  -c  SPI clock used to project transfer time (default 4000000)\n"
+		"  -t  mono cutoff (default 32)\n"
+		"  -d  ordered dithering\n"
+		"  -i  inversion\n"
+		"  -n  replay the trace this many times to stabilize timing\n"
+		"  -o  add a solid overlay, negative positions count from the\n"
+		"      right and bottom edges\n", argv0);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static int add_overlay(struct replay_options *opts, char const *arg)
+{
+	struct sharp_overlay_t *ov;
+	unsigned char *pixels;
+
+	if (opts->num_overlays == MAX_OVERLAYS) {
+		return -1;
+	}
+
+	ov = &opts->overlays[opts->num_overlays];
+	if ((sscanf(arg, "%d,%d,%d,%d", &ov->x, &ov->y, &ov->width, &ov->height) != 4)
+	 || (ov->width <= 0) || (ov->height <= 0)) {
+		return -1;
+	}
+
+	pixels = malloc(ov->width * ov->height);
+	if (!pixels) {
+		return -1;
+	}
+	memset(pixels, 0xff, ov->width * ov->height);
+	ov->pixels = pixels;
+
+	opts->num_overlays++;
+
+	return 0;
+}
+
+static int read_file(char const *path, unsigned char **data, size_t *len)
+{
+	FILE *f;
+	size_t cap = 1 << 20, n;
+	unsigned char *buf, *grown;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		return -1;
+	}
+
+	buf = malloc(cap);
+	*len = 0;
+	while (buf && ((n = fread(buf + *len, 1, cap - *len, f)) > 0)) {
+		*len += n;
+		if (*len == cap) {
+			cap *= 2;
+			grown = realloc(buf, cap);
+			if (!grown) {
+				free(buf);
+			}
+			buf = grown;
+		}
+	}
+
+	fclose(f);
+	*data = buf;
+
+	return (buf) ? 0 : -1;
+}
+
+// Trace record fields in host order
+struct replay_record
+{
+	unsigned long long time_ns;
+	int y1, y2;
+	int fb_width;
+	size_t data_len;
+};
+
+// Traces are little-endian
+static void decode_record(unsigned char const *src, struct replay_record *rec)
+{
+	struct sharp_memory_trace_record raw;
+
+	memcpy(&raw, src, sizeof(raw));
+	rec->time_ns = le64toh(raw.time_ns);
+	rec->y1 = (__s16)le16toh(raw.y1);
+	rec->y2 = (__s16)le16toh(raw.y2);
+	rec->fb_width = le16toh(raw.fb_width);
+	rec->data_len = le32toh(raw.data_len);
+}
+
+static void replay(struct replay_options const *opts, int width, int height,
+	unsigned char const *records, size_t len, struct replay_stats *stats)
+{
+	int const tagged_line_len = 2 + width / 8;
+	unsigned char *gray, *mono, *tx, *scratch, *dirty;
+	struct replay_record rec;
+	size_t off = 0;
+	int y, y1, y2, b, i, scale, fb_height, lines;
+	double start, elapsed;
+
+	gray = calloc(width, height);
+	scratch = calloc(width, height);
+	mono = calloc(tagged_line_len, height);
+	tx = calloc(tagged_line_len, height);
+	dirty = calloc(height, 1);
+	if (!gray || !scratch || !mono || !tx || !dirty) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+
+	for (y = 0; y < height; y++) {
+		mono[y * tagged_line_len] = sharp_memory_reverse_byte((u8)(y + 1));
+	}
+
+	while (off + sizeof(struct sharp_memory_trace_record) <= len) {
+		decode_record(records + off, &rec);
+		off += sizeof(struct sharp_memory_trace_record);
+		if (off + rec.data_len > len) {
+			break;
+		}
+
+		if (!stats->frames) {
+			stats->first_ns = rec.time_ns;
+		}
+		stats->last_ns = rec.time_ns;
+		stats->frames++;
+
+		scale = (rec.fb_width && (rec.fb_width * 2 == width)) ? 2 : 1;
+		fb_height = height / scale;
+		y1 = (rec.y1 < 0) ? 0 : rec.y1;
+		y2 = (rec.y2 > fb_height) ? fb_height : rec.y2;
+
+		// New contents land in the framebuffer copy, otherwise the
+		// previous contents are converted again. Contents of rows outside
+		// the framebuffer are not trusted
+		if ((0 <= rec.y1) && (rec.y1 <= rec.y2) && (rec.y2 <= fb_height)
+		 && (rec.data_len == (size_t)(rec.y2 - rec.y1) * (width / scale))) {
+			memcpy(&gray[rec.y1 * (width / scale)], records + off, rec.data_len);
+		} else {
+			stats->frames_without_contents++;
+		}
+		off += rec.data_len;
+
+		if (y2 <= y1) {
+			continue;
+		}
+
+		start = now_ns();
+
+		// Convert and store damaged rows, as in sharp_memory_fb_dirty()
+		if (scale == 2) {
+			sharp_memory_gray8_to_mono_tagged_2x(scratch,
+				&gray[y1 * (width / 2)], width / 2, y2 - y1, y1 * 2,
+				&opts->profile);
+		} else {
+			sharp_memory_gray8_to_mono_tagged(scratch,
+				&gray[y1 * width], width, y2 - y1, y1, &opts->profile);
+		}
+		memcpy(&mono[y1 * scale * tagged_line_len], scratch,
+			(y2 - y1) * scale * tagged_line_len);
+		memset(&dirty[y1 * scale], 1, (y2 - y1) * scale);
+
+		// Gather dirty lines, as in sharp_memory_gather_dirty()
+		lines = 0;
+		for (y = 0; y < height; y++) {
+			if (!dirty[y]) {
+				continue;
+			}
+			dirty[y] = 0;
+
+			memcpy(&tx[lines * tagged_line_len], &mono[y * tagged_line_len],
+				tagged_line_len);
+			for (i = 0; i < opts->num_overlays; i++) {
+				sharp_memory_draw_overlay(&tx[lines * tagged_line_len],
+					width, height, y, y + 1, &opts->overlays[i],
+					opts->profile.cutoff);
+			}
+			if (opts->profile.invert) {
+				for (b = 1; b < tagged_line_len - 1; b++) {
+					tx[(lines * tagged_line_len) + b] ^= 0xff;
+				}
+			}
+			lines++;
+		}
+
+		elapsed = now_ns() - start;
+
+		stats->lines += lines;
+		stats->max_lines = (lines > stats->max_lines) ? lines : stats->max_lines;
+		stats->bytes += 2 + (lines * tagged_line_len); // Command and trailer
+		stats->cpu_ns += elapsed;
+		stats->max_cpu_ns = (elapsed > stats->max_cpu_ns) ? elapsed : stats->max_cpu_ns;
+	}
+
+	free(gray);
+	free(scratch);
+	free(mono);
+	free(tx);
+	free(dirty);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay_options opts = {
+		.spi_hz = 4000000,
+		.iterations = 1,
+		.profile = { .cutoff = 32, .invert = 0, .dither = SHARP_MEMORY_DITHER_NONE },
+	};
+	struct replay_stats stats;
+	struct sharp_memory_trace_header header;
+	unsigned char *data;
+	size_t len;
+	double frames, spi_ms, duration_ms;
+	int c, i, width, height;
+
+	while ((c = getopt(argc, argv, "c:t:din:o:")) != -1) {
+		switch (c) {
+		case 'c': opts.spi_hz = atol(optarg); break;
+		case 't': opts.profile.cutoff = atoi(optarg); break;
+		case 'd': opts.profile.dither = SHARP_MEMORY_DITHER_ORDERED; break;
+		case 'i': opts.profile.invert = 1; break;
+		case 'n': opts.iterations = atoi(optarg); break;
+		case 'o':
+			if (add_overlay(&opts, optarg)) {
+				fprintf(stderr, "bad overlay '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((optind != argc - 1) || (opts.spi_hz <= 0) || (opts.iterations <= 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if (read_file(argv[optind], &data, &len)) {
+		fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+		return 1;
+	}
+
+	if (len < sizeof(header)) {
+		fprintf(stderr, "%s: truncated trace\n", argv[optind]);
+		return 1;
+	}
+	memcpy(&header, data, sizeof(header));
+	width = le16toh(header.panel_width);
+	height = le16toh(header.panel_height);
+	if ((le32toh(header.magic) != SHARP_MEMORY_TRACE_MAGIC)
+	 || (le16toh(header.version) != SHARP_MEMORY_TRACE_VERSION)
+	 || (width % 8) || !height) {
+		fprintf(stderr, "%s: not a version %d damage trace\n", argv[optind],
+			SHARP_MEMORY_TRACE_VERSION);
+		return 1;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+	for (i = 0; i < opts.iterations; i++) {
+		replay(&opts, width, height, data + sizeof(header),
+			len - sizeof(header), &stats);
+	}
+
+	if (!stats.frames) {
+		printf("no frames\n");
+		return 0;
+	}
+
+	frames = stats.frames;
+	spi_ms = (stats.bytes * 8.0 * 1000.0) / opts.spi_hz;
+	duration_ms = (stats.last_ns - stats.first_ns) / 1e6;
+
+	printf("panel:              %dx%d\n", width, height);
+	printf("frames:             %ld (%ld without contents)\n",
+		stats.frames / opts.iterations,
+		stats.frames_without_contents / opts.iterations);
+	printf("trace duration:     %.1f ms\n", duration_ms);
+	printf("lines/frame:        %.1f avg, %ld max\n", stats.lines / frames, stats.max_lines);
+	printf("bytes/frame:        %.1f avg\n", stats.bytes / frames);
+	printf("cpu ms/frame:       %.4f avg, %.4f max\n",
+		stats.cpu_ns / frames / 1e6, stats.max_cpu_ns / 1e6);
+	printf("spi ms/frame:       %.3f avg at %ld Hz\n", spi_ms / frames, opts.spi_hz);
+	if (duration_ms > 0) {
+		printf("spi bus busy:       %.1f%%\n",
+			100.0 * (spi_ms / opts.iterations) / duration_ms);
+	}
+
+	free(data);
+
+	return 0;
+}
@@ -0,0 +1,428 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * In-kernel stress test for the overlay and indicator API exported by
+ * sharp-drm.
+ *
+ * Loading the module runs the test: `threads` kernel threads add, show,
+ * move, update, hide and remove overlays, text overlays and redraws, and
+ * a timer toggles an indicator from interrupt context, for `duration_ms`.
+ * Every call is timed, and per-call throughput, tail latency and API
+ * failures are logged. Loading fails if any call failed. Run it while
+ * tools/stress checks the panel output.
+ */
+
+#include <linux/hrtimer.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <linux/sort.h>
+#include <linux/version.h>
+#include <linux/vmalloc.h>
+
+// Before 6.2 the bounded variant has its older name
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 2, 0)
+#define get_random_u32_below(ceil) prandom_u32_max(ceil)
+#endif
+
+// Exported by sharp-drm
+void* sharp_memory_add_overlay(int x, int y, int width, int height,
+	unsigned char const* pixels);
+void sharp_memory_remove_overlay(void* entry);
+void* sharp_memory_show_overlay(void* storage);
+void sharp_memory_hide_overlay(void* display);
+int sharp_memory_update_overlay(void* storage, int width, int height,
+	unsigned char const* pixels);
+int sharp_memory_move_overlay(void* storage, int x, int y);
+void* sharp_memory_add_text(int x, int y, char const* font, int flags,
+	char const* text);
+int sharp_memory_set_text(void* storage, char const* text);
+void* sharp_memory_add_indicator(int x, int y, int width, int height,
+	unsigned char const* pixels);
+void sharp_memory_remove_indicator(void* indicator);
+void sharp_memory_show_indicator(void* indicator, bool show);
+int sharp_memory_redraw_lines(unsigned long const *lines, int nbits);
+
+static int threads = 4;
+module_param(threads, int, 0444);
+MODULE_PARM_DESC(threads, "Kernel threads calling the overlay API (default 4)");
+
+static int duration_ms = 5000;
+module_param(duration_ms, int, 0444);
+MODULE_PARM_DESC(duration_ms, "Test duration in milliseconds (default 5000)");
+
+#define MAX_THREADS 64
+#define SAMPLES_PER_OP 65536
+#define OVERLAYS_PER_THREAD 4
+#define PANEL_LINES 240
+
+enum stress_op
+{
+	OP_ADD,
+	OP_ADD_TEXT,
+	OP_SHOW,
+	OP_MOVE,
+	OP_UPDATE,
+	OP_SET_TEXT,
+	OP_HIDE,
+	OP_REMOVE,
+	OP_REDRAW_LINES,
+	OP_SHOW_INDICATOR,
+	NUM_OPS
+};
+
+static char const *op_names[NUM_OPS] = {
+	"add", "add_text", "show", "move", "update", "set_text", "hide",
+	"remove", "redraw_lines", "show_indicator",
+};
+
+struct op_stats
+{
+	u64 *samples_ns;
+	unsigned int count;
+	unsigned long errors;
+};
+
+struct stress_thread
+{
+	struct task_struct *task;
+	int index;
+	struct op_stats stats[NUM_OPS];
+	struct completion done;
+};
+
+// Overlay slot of one thread, with its display if shown
+struct stress_overlay
+{
+	void *storage;
+	void *display;
+	bool text;
+};
+
+static struct stress_thread *g_threads;
+static struct op_stats g_indicator_stats;
+static void *g_indicator;
+static bool g_indicator_shown;
+static struct hrtimer g_indicator_timer;
+static ktime_t g_deadline;
+
+static void record(struct op_stats *stats, u64 start_ns, bool failed)
+{
+	if (stats->count < SAMPLES_PER_OP) {
+		stats->samples_ns[stats->count++] = ktime_get_ns() - start_ns;
+	}
+	if (failed) {
+		stats->errors++;
+	}
+}
+
+static void stress_overlays(struct stress_thread *t)
+{
+	struct stress_overlay slots[OVERLAYS_PER_THREAD] = { 0 };
+	struct stress_overlay *slot;
+	unsigned char pixels[32 * 16];
+	char text[16];
+	u64 start;
+	int rc;
+	unsigned int i;
+
+	while (ktime_before(ktime_get(), g_deadline)) {
+		slot = &slots[get_random_u32_below(OVERLAYS_PER_THREAD)];
+
+		if (!slot->storage) {
+			slot->text = get_random_u32_below(2);
+			start = ktime_get_ns();
+			if (slot->text) {
+				snprintf(text, sizeof(text), "k%d", t->index);
+				slot->storage = sharp_memory_add_text(
+					get_random_u32_below(400), get_random_u32_below(240),
+					"VGA8x8", 0, text);
+				record(&t->stats[OP_ADD_TEXT], start, !slot->storage);
+			} else {
+				memset(pixels, get_random_u8(), sizeof(pixels));
+				slot->storage = sharp_memory_add_overlay(
+					get_random_u32_below(400), get_random_u32_below(240),
+					32, 16, pixels);
+				record(&t->stats[OP_ADD], start, !slot->storage);
+			}
+			continue;
+		}
+
+		start = ktime_get_ns();
+		switch (get_random_u32_below(5)) {
+		case 0:
+			if (!slot->display) {
+				slot->display = sharp_memory_show_overlay(slot->storage);
+				record(&t->stats[OP_SHOW], start, !slot->display);
+			}
+			break;
+		case 1:
+			rc = sharp_memory_move_overlay(slot->storage,
+				get_random_u32_below(400), get_random_u32_below(240));
+			record(&t->stats[OP_MOVE], start, rc);
+			break;
+		case 2:
+			if (slot->text) {
+				snprintf(text, sizeof(text), "%u", get_random_u32());
+				rc = sharp_memory_set_text(slot->storage, text);
+				record(&t->stats[OP_SET_TEXT], start, rc);
+			} else {
+				memset(pixels, get_random_u8(), sizeof(pixels));
+				rc = sharp_memory_update_overlay(slot->storage, 32, 16, pixels);
+				record(&t->stats[OP_UPDATE], start, rc);
+			}
+			break;
+		case 3:
+			if (slot->display) {
+				sharp_memory_hide_overlay(slot->display);
+				record(&t->stats[OP_HIDE], start, false);
+				slot->display = NULL;
+			}
+			break;
+		case 4:
+			// Removing hides the overlay too
+			sharp_memory_remove_overlay(slot->storage);
+			record(&t->stats[OP_REMOVE], start, false);
+			slot->storage = NULL;
+			slot->display = NULL;
+			break;
+		}
+
+		cond_resched();
+	}
+
+	for (i = 0; i < OVERLAYS_PER_THREAD; i++) {
+		if (slots[i].storage) {
+			sharp_memory_remove_overlay(slots[i].storage);
+		}
+	}
+}
+
+static void stress_redraws(struct stress_thread *t)
+{
+	DECLARE_BITMAP(lines, PANEL_LINES);
+	unsigned int y;
+	u64 start;
+	int rc;
+
+	while (ktime_before(ktime_get(), g_deadline)) {
+		bitmap_zero(lines, PANEL_LINES);
+		y = get_random_u32_below(PANEL_LINES - 16);
+		bitmap_set(lines, y, 1 + get_random_u32_below(16));
+
+		start = ktime_get_ns();
+		rc = sharp_memory_redraw_lines(lines, PANEL_LINES);
+		record(&t->stats[OP_REDRAW_LINES], start, rc && (rc != -ENODEV));
+
+		cond_resched();
+	}
+}
+
+static int stress_thread_fn(void *data)
+{
+	struct stress_thread *t = data;
+
+	// One in four threads redraws, the others churn overlays
+	if ((t->index % 4) == 3) {
+		stress_redraws(t);
+	} else {
+		stress_overlays(t);
+	}
+
+	complete(&t->done);
+
+	// Wait for kthread_stop() so the task is still there to stop
+	while (!kthread_should_stop()) {
+		schedule_timeout_interruptible(1);
+	}
+
+	return 0;
+}
+
+// Indicators can be shown and hidden from hard interrupt context
+static enum hrtimer_restart indicator_timer_fn(struct hrtimer *timer)
+{
+	u64 const start = ktime_get_ns();
+
+	g_indicator_shown = !g_indicator_shown;
+	sharp_memory_show_indicator(g_indicator, g_indicator_shown);
+	record(&g_indicator_stats, start, false);
+
+	if (!ktime_before(ktime_get(), g_deadline)) {
+		return HRTIMER_NORESTART;
+	}
+
+	hrtimer_forward_now(timer, ms_to_ktime(1));
+	return HRTIMER_RESTART;
+}
+
+static int cmp_u64(void const *a, void const *b)
+{
+	u64 const x = *(u64 const *)a, y = *(u64 const *)b;
+
+	return (x > y) - (x < y);
+}
+
+// Merge samples of `op` from every thread, then log throughput and tail
+// latency. Returns the number of failed calls
+static unsigned long report_op(int op, struct op_stats const *extra)
+{
+	u64 *merged;
+	unsigned int count = 0, i;
+	unsigned long errors = 0;
+	int n;
+
+	for (n = 0; n < threads; n++) {
+		count += g_threads[n].stats[op].count;
+	}
+	if (extra) {
+		count += extra->count;
+	}
+	if (!count) {
+		return 0;
+	}
+
+	merged = vmalloc(array_size(count, sizeof(u64)));
+	if (!merged) {
+		return 0;
+	}
+
+	count = 0;
+	for (n = 0; n < threads; n++) {
+		memcpy(&merged[count], g_threads[n].stats[op].samples_ns,
+			g_threads[n].stats[op].count * sizeof(u64));
+		count += g_threads[n].stats[op].count;
+		errors += g_threads[n].stats[op].errors;
+	}
+	if (extra) {
+		memcpy(&merged[count], extra->samples_ns, extra->count * sizeof(u64));
+		count += extra->count;
+		errors += extra->errors;
+	}
+	sort(merged, count, sizeof(u64), cmp_u64, NULL);
+
+	i = count - 1;
+	pr_info("sharp_stress: %-14s %8u calls %8llu/s  p50 %6llu us  p99 %6llu us  p99.9 %6llu us  max %6llu us  %lu errors\n",
+		op_names[op], count, div_u64((u64)count * 1000, duration_ms),
+		div_u64(merged[(i * 50) / 100], 1000),
+		div_u64(merged[(i * 99) / 100], 1000),
+		div_u64(merged[(i * 999) / 1000], 1000),
+		div_u64(merged[i], 1000), errors);
+
+	vfree(merged);
+
+	return errors;
+}
+
+static void free_stats(struct op_stats *stats)
+{
+	vfree(stats->samples_ns);
+	stats->samples_ns = NULL;
+}
+
+static int alloc_stats(struct op_stats *stats)
+{
+	stats->samples_ns = vmalloc(array_size(SAMPLES_PER_OP, sizeof(u64)));
+	stats->count = 0;
+	stats->errors = 0;
+
+	return (stats->samples_ns) ? 0 : -ENOMEM;
+}
+
+static int __init sharp_stress_init(void)
+{
+	static unsigned char const indicator_pixels[8 * 8] = { 0 };
+	unsigned long errors = 0;
+	int rc = 0, n, op, started = 0;
+
+	if ((threads < 1) || (threads > MAX_THREADS) || (duration_ms <= 0)) {
+		return -EINVAL;
+	}
+
+	g_threads = kcalloc(threads, sizeof(*g_threads), GFP_KERNEL);
+	if (!g_threads) {
+		return -ENOMEM;
+	}
+	for (n = 0; n < threads; n++) {
+		g_threads[n].index = n;
+		init_completion(&g_threads[n].done);
+		for (op = 0; op < NUM_OPS; op++) {
+			if ((rc = alloc_stats(&g_threads[n].stats[op]))) {
+				goto out_free;
+			}
+		}
+	}
+	if ((rc = alloc_stats(&g_indicator_stats))) {
+		goto out_free;
+	}
+
+	g_indicator = sharp_memory_add_indicator(392, 0, 8, 8, indicator_pixels);
+	if (!g_indicator) {
+		rc = -ENOMEM;
+		goto out_free;
+	}
+	g_indicator_shown = false;
+
+	pr_info("sharp_stress: %d threads for %d ms\n", threads, duration_ms);
+	g_deadline = ktime_add_ms(ktime_get(), duration_ms);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0)
+	hrtimer_setup(&g_indicator_timer, indicator_timer_fn, CLOCK_MONOTONIC,
+		HRTIMER_MODE_REL);
+#else
+	hrtimer_init(&g_indicator_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	g_indicator_timer.function = indicator_timer_fn;
+#endif
+	hrtimer_start(&g_indicator_timer, ms_to_ktime(1), HRTIMER_MODE_REL);
+
+	for (n = 0; n < threads; n++) {
+		g_threads[n].task = kthread_run(stress_thread_fn, &g_threads[n],
+			"sharp_stress/%d", n);
+		if (IS_ERR(g_threads[n].task)) {
+			rc = PTR_ERR(g_threads[n].task);
+			g_deadline = ktime_get();
+			break;
+		}
+		started++;
+	}
+
+	for (n = 0; n < started; n++) {
+		wait_for_completion(&g_threads[n].done);
+		kthread_stop(g_threads[n].task);
+	}
+	hrtimer_cancel(&g_indicator_timer);
+
+	sharp_memory_show_indicator(g_indicator, false);
+	sharp_memory_remove_indicator(g_indicator);
+
+	if (!rc) {
+		for (op = 0; op < NUM_OPS; op++) {
+			errors += report_op(op,
+				(op == OP_SHOW_INDICATOR) ? &g_indicator_stats : NULL);
+		}
+		pr_info("sharp_stress: %s, %lu failed calls\n",
+			(errors) ? "FAIL" : "PASS", errors);
+		rc = (errors) ? -EINVAL : 0;
+	}
+
+out_free:
+	for (n = 0; n < threads; n++) {
+		for (op = 0; op < NUM_OPS; op++) {
+			free_stats(&g_threads[n].stats[op]);
+		}
+	}
+	free_stats(&g_indicator_stats);
+	kfree(g_threads);
+
+	return rc;
+}
+
+static void __exit sharp_stress_exit(void)
+{}
+
+module_init(sharp_stress_init);
+module_exit(sharp_stress_exit);
+
+MODULE_DESCRIPTION("Stress test for the Sharp Memory LCD DRM driver");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,1176 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/*
+ * Concurrency stress test and benchmark for the driver's userspace paths.
+ *
+ * Worker threads hammer the overlay ioctls, each on its own DRM file, the
+ * redraw ioctls, and page flips and dirty framebuffer calls on the master
+ * file. Every call is timed. A checker thread keeps reading the frame
+ * dump in debugfs meanwhile. Once the workers stop, atomic commits that
+ * only touch an overlay or cursor plane must deliver their flip events,
+ * and a known framebuffer and overlay are drawn and the dump is compared
+ * against them pixel by pixel.
+ *
+ * Without a panel, load the driver with `qemu_display_dev=/dev/null` so
+ * that transfers go to a null sink.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <drm/drm.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_mode.h>
+
+// Kernel prototypes in the driver header only need these declared
+struct drm_device;
+struct drm_file;
+#include "ioctl_iface.h"
+
+#define MAX_THREADS 64
+#define SAMPLES_PER_OP (1 << 20)
+#define OVERLAYS_PER_THREAD 4
+
+enum stress_op
+{
+	OP_OV_ADD,
+	OP_OV_SHOW,
+	OP_OV_MOVE,
+	OP_OV_UPDATE,
+	OP_OV_SET_TEXT,
+	OP_OV_HIDE,
+	OP_OV_REM,
+	OP_REDRAW,
+	OP_REDRAW_RECT,
+	OP_DIRTYFB,
+	OP_PAGE_FLIP,
+	OP_FRAME_READ,
+	NUM_OPS
+};
+
+static char const *op_names[NUM_OPS] = {
+	"ov_add", "ov_show", "ov_move", "ov_update", "ov_set_text", "ov_hide",
+	"ov_rem", "redraw", "redraw_rect", "dirtyfb", "page_flip", "frame_read",
+};
+
+struct op_stats
+{
+	double *samples_us;
+	size_t count;
+	long errors;
+	long busy;
+};
+
+struct stress_options
+{
+	char const *card;
+	char const *frame_path;
+	int threads;
+	int seconds;
+	int commits;
+	int panel_width, panel_height;
+};
+
+// Master file state, shared by commit threads
+struct stress_display
+{
+	int fd;
+	unsigned int crtc_id;
+	unsigned int fb_ids[2];
+	unsigned char *fb_maps[2];
+	unsigned int width, height, pitch;
+	size_t fb_size;
+	int ready;
+};
+
+struct stress_thread
+{
+	pthread_t thread;
+	int index;
+	unsigned int seed;
+	struct stress_options const *opts;
+	struct stress_display *display;
+	struct op_stats stats[NUM_OPS];
+	long frame_errors;
+};
+
+static volatile int g_stop;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+static void usage(char const *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-d card] [-f frame] [-t threads] [-s seconds] [-n]\n"
+		"  -d  DRM device (default /dev/dri/card0)\n"
+		"  -f  frame dump (default /sys/kernel/debug/sharp_drm/frame)\n"
+		"  -t  worker threads (default 8, up to %d)\n"
+		"  -s  run time in seconds (default 10)\n"
+		"  -n  no page flips or dirty framebuffer calls, for when\n"
+		"      another client holds DRM master\n", argv0, MAX_THREADS);
+}
+
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+	int rc;
+
+	do {
+		rc = ioctl(fd, request, arg);
+	} while ((rc == -1) && ((errno == EINTR) || (errno == EAGAIN)));
+
+	return (rc == -1) ? -errno : 0;
+}
+
+// Time one call into `stats`. -EBUSY is counted apart from errors, page
+// flips return it while the previous flip is pending
+static int timed_ioctl(struct op_stats *stats, int fd, unsigned long request,
+	void *arg)
+{
+	double start;
+	int rc;
+
+	start = now_us();
+	rc = xioctl(fd, request, arg);
+	if (stats->count < SAMPLES_PER_OP) {
+		stats->samples_us[stats->count++] = now_us() - start;
+	}
+
+	if (rc == -EBUSY) {
+		stats->busy++;
+	} else if (rc) {
+		stats->errors++;
+	}
+
+	return rc;
+}
+
+/* Frame dump */
+
+struct frame
+{
+	int width, height;
+	unsigned char *bits; // PBM rows, set bits are black
+};
+
+static int read_frame(char const *path, struct frame *frame)
+{
+	FILE *f;
+	int width, height;
+	size_t len;
+
+	if ((f = fopen(path, "rb")) == NULL) {
+		return -errno;
+	}
+
+	if ((fscanf(f, "P4 %d %d", &width, &height) != 2) || (fgetc(f) != '\n')
+	 || (width <= 0) || (height <= 0) || (width % 8)) {
+		fclose(f);
+		return -EPROTO;
+	}
+
+	len = (size_t)(width / 8) * height;
+	if (!frame->bits || (frame->width != width) || (frame->height != height)) {
+		free(frame->bits);
+		frame->bits = malloc(len);
+		if (!frame->bits) {
+			fclose(f);
+			return -ENOMEM;
+		}
+		frame->width = width;
+		frame->height = height;
+	}
+
+	// A short dump is as bad as a wrong header
+	if (fread(frame->bits, 1, len, f) != len) {
+		fclose(f);
+		return -EPROTO;
+	}
+	if (fgetc(f) != EOF) {
+		fclose(f);
+		return -EPROTO;
+	}
+
+	fclose(f);
+
+	return 0;
+}
+
+// Panel pixel is white
+static int frame_white(struct frame const *frame, int x, int y)
+{
+	return !(frame->bits[(y * (frame->width / 8)) + (x / 8)] & (0x80 >> (x % 8)));
+}
+
+/* Display setup */
+
+static int get_connector_mode(int fd, unsigned int connector_id,
+	struct drm_mode_modeinfo *mode)
+{
+	struct drm_mode_get_connector conn;
+	struct drm_mode_modeinfo *modes;
+	int rc;
+
+	memset(&conn, 0, sizeof(conn));
+	conn.connector_id = connector_id;
+	if ((rc = xioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn))) {
+		return rc;
+	}
+	if (!conn.count_modes) {
+		return -ENOENT;
+	}
+
+	modes = calloc(conn.count_modes, sizeof(*modes));
+	if (!modes) {
+		return -ENOMEM;
+	}
+	conn.count_props = 0;
+	conn.count_encoders = 0;
+	conn.modes_ptr = (unsigned long)modes;
+	if ((rc = xioctl(fd, DRM_IOCTL_MODE_GETCONNECTOR, &conn)) == 0) {
+		*mode = modes[0];
+	}
+	free(modes);
+
+	return rc;
+}
+
+static int create_fb(struct stress_display *display, int i)
+{
+	struct drm_mode_create_dumb create;
+	struct drm_mode_map_dumb map;
+	struct drm_mode_fb_cmd cmd;
+	void *addr;
+	int rc;
+
+	memset(&create, 0, sizeof(create));
+	create.width = display->width;
+	create.height = display->height;
+	create.bpp = 32;
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))) {
+		return rc;
+	}
+	display->pitch = create.pitch;
+	display->fb_size = create.size;
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.width = display->width;
+	cmd.height = display->height;
+	cmd.pitch = create.pitch;
+	cmd.bpp = 32;
+	cmd.depth = 24;
+	cmd.handle = create.handle;
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_ADDFB, &cmd))) {
+		return rc;
+	}
+	display->fb_ids[i] = cmd.fb_id;
+
+	memset(&map, 0, sizeof(map));
+	map.handle = create.handle;
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_MAP_DUMB, &map))) {
+		return rc;
+	}
+
+	addr = mmap(NULL, create.size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		display->fd, map.offset);
+	if (addr == MAP_FAILED) {
+		return -errno;
+	}
+	display->fb_maps[i] = addr;
+	memset(addr, 0xff, create.size);
+
+	return 0;
+}
+
+// Show the first framebuffer on the first CRTC. Needs DRM master
+static int setup_display(struct stress_display *display)
+{
+	struct drm_mode_card_res res;
+	struct drm_mode_crtc crtc;
+	struct drm_mode_modeinfo mode;
+	unsigned int crtc_ids[4], connector_ids[4];
+	int rc;
+
+	memset(&res, 0, sizeof(res));
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_GETRESOURCES, &res))) {
+		return rc;
+	}
+	if (!res.count_crtcs || !res.count_connectors) {
+		return -ENOENT;
+	}
+	res.count_crtcs = (res.count_crtcs > 4) ? 4 : res.count_crtcs;
+	res.count_connectors = (res.count_connectors > 4) ? 4 : res.count_connectors;
+	res.count_fbs = 0;
+	res.count_encoders = 0;
+	res.crtc_id_ptr = (unsigned long)crtc_ids;
+	res.connector_id_ptr = (unsigned long)connector_ids;
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_GETRESOURCES, &res))) {
+		return rc;
+	}
+
+	if ((rc = get_connector_mode(display->fd, connector_ids[0], &mode))) {
+		return rc;
+	}
+	display->crtc_id = crtc_ids[0];
+	display->width = mode.hdisplay;
+	display->height = mode.vdisplay;
+
+	if ((rc = create_fb(display, 0)) || (rc = create_fb(display, 1))) {
+		return rc;
+	}
+
+	memset(&crtc, 0, sizeof(crtc));
+	crtc.crtc_id = display->crtc_id;
+	crtc.fb_id = display->fb_ids[0];
+	crtc.set_connectors_ptr = (unsigned long)connector_ids;
+	crtc.count_connectors = 1;
+	crtc.mode = mode;
+	crtc.mode_valid = 1;
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_SETCRTC, &crtc))) {
+		return rc;
+	}
+
+	display->ready = 1;
+
+	return 0;
+}
+
+// Fill rows [y1, y2) with a pattern that changes with `phase`
+static void fill_rows(struct stress_display const *display, int i,
+	unsigned int y1, unsigned int y2, unsigned int phase)
+{
+	unsigned int x, y;
+	unsigned int *row;
+
+	for (y = y1; y < y2; y++) {
+		row = (unsigned int *)(display->fb_maps[i] + (y * display->pitch));
+		for (x = 0; x < display->width; x++) {
+			row[x] = (((x + phase) / 8 + y / 8) % 2) ? 0xffffff : 0;
+		}
+	}
+}
+
+/* Workers */
+
+// Overlay client with its own DRM file, so its handles are private
+static void overlay_worker(struct stress_thread *t)
+{
+	unsigned int handles[OVERLAYS_PER_THREAD] = { 0 };
+	unsigned int displays[OVERLAYS_PER_THREAD] = { 0 };
+	int is_text[OVERLAYS_PER_THREAD] = { 0 };
+	int const width = t->opts->panel_width, height = t->opts->panel_height;
+	unsigned char pixels[32 * 16];
+	struct sharp_overlay_t ov;
+	union sharp_memory_ioctl_ov_add_t add;
+	union sharp_memory_ioctl_ov_show_t show;
+	struct sharp_memory_ioctl_ov_hide_t hide;
+	struct sharp_memory_ioctl_ov_rem_t rem;
+	struct sharp_memory_ioctl_ov_move_t move;
+	struct sharp_memory_ioctl_ov_update_t update;
+	struct sharp_memory_ioctl_ov_add_text_t add_text;
+	struct sharp_memory_ioctl_ov_set_text_t set_text;
+	unsigned int i;
+	int fd;
+
+	if ((fd = open(t->opts->card, O_RDWR | O_CLOEXEC)) < 0) {
+		perror(t->opts->card);
+		return;
+	}
+
+	while (!g_stop) {
+		i = rand_r(&t->seed) % OVERLAYS_PER_THREAD;
+
+		// Create, or one of the calls on an existing overlay
+		if (!handles[i]) {
+			if (rand_r(&t->seed) % 2) {
+				memset(pixels, rand_r(&t->seed) & 0xff, sizeof(pixels));
+				ov.x = rand_r(&t->seed) % width;
+				ov.y = rand_r(&t->seed) % height;
+				ov.width = 32;
+				ov.height = 16;
+				ov.pixels = pixels;
+				add.in_overlay = &ov;
+				if (!timed_ioctl(&t->stats[OP_OV_ADD], fd,
+					DRM_IOCTL_SHARP_OV_ADD, &add)) {
+					handles[i] = add.out_handle;
+					is_text[i] = 0;
+				}
+			} else {
+				memset(&add_text, 0, sizeof(add_text));
+				add_text.x = rand_r(&t->seed) % width;
+				add_text.y = rand_r(&t->seed) % height;
+				strcpy(add_text.font, "VGA8x8");
+				snprintf(add_text.text, sizeof(add_text.text), "t%d", t->index);
+				if (!timed_ioctl(&t->stats[OP_OV_ADD], fd,
+					DRM_IOCTL_SHARP_OV_ADD_TEXT, &add_text)) {
+					handles[i] = add_text.out_handle;
+					is_text[i] = 1;
+				}
+			}
+			continue;
+		}
+
+		switch (rand_r(&t->seed) % 6) {
+		case 0:
+			if (!displays[i]) {
+				show.in_handle = handles[i];
+				if (!timed_ioctl(&t->stats[OP_OV_SHOW], fd,
+					DRM_IOCTL_SHARP_OV_SHOW, &show)) {
+					displays[i] = show.out_display;
+				}
+			}
+			break;
+		case 1:
+			move.handle = handles[i];
+			move.x = rand_r(&t->seed) % width;
+			move.y = rand_r(&t->seed) % height;
+			timed_ioctl(&t->stats[OP_OV_MOVE], fd, DRM_IOCTL_SHARP_OV_MOVE,
+				&move);
+			break;
+		case 2:
+		case 3:
+			if (is_text[i]) {
+				set_text.handle = handles[i];
+				snprintf(set_text.text, sizeof(set_text.text), "%u",
+					rand_r(&t->seed));
+				timed_ioctl(&t->stats[OP_OV_SET_TEXT], fd,
+					DRM_IOCTL_SHARP_OV_SET_TEXT, &set_text);
+			} else {
+				memset(pixels, rand_r(&t->seed) & 0xff, sizeof(pixels));
+				update.handle = handles[i];
+				update.width = 32;
+				update.height = 16;
+				update.pixels = pixels;
+				timed_ioctl(&t->stats[OP_OV_UPDATE], fd,
+					DRM_IOCTL_SHARP_OV_UPDATE, &update);
+			}
+			break;
+		case 4:
+			if (displays[i]) {
+				hide.display = displays[i];
+				timed_ioctl(&t->stats[OP_OV_HIDE], fd, DRM_IOCTL_SHARP_OV_HIDE,
+					&hide);
+				displays[i] = 0;
+			}
+			break;
+		case 5:
+			// Removing takes displays of the overlay with it
+			rem.handle = handles[i];
+			timed_ioctl(&t->stats[OP_OV_REM], fd, DRM_IOCTL_SHARP_OV_REM, &rem);
+			handles[i] = 0;
+			displays[i] = 0;
+			break;
+		}
+	}
+
+	// Closing the file removes whatever is left
+	close(fd);
+}
+
+static void redraw_worker(struct stress_thread *t)
+{
+	struct sharp_memory_ioctl_redraw_rect_t rect;
+	int fd;
+
+	if ((fd = open(t->opts->card, O_RDWR | O_CLOEXEC)) < 0) {
+		perror(t->opts->card);
+		return;
+	}
+
+	while (!g_stop) {
+		if (rand_r(&t->seed) % 8) {
+			memset(&rect, 0, sizeof(rect));
+			rect.x1 = 0;
+			rect.y1 = rand_r(&t->seed) % t->opts->panel_height;
+			rect.x2 = t->opts->panel_width;
+			rect.y2 = rect.y1 + 1 + (rand_r(&t->seed) % 16);
+			timed_ioctl(&t->stats[OP_REDRAW_RECT], fd,
+				DRM_IOCTL_SHARP_REDRAW_RECT, &rect);
+		} else {
+			timed_ioctl(&t->stats[OP_REDRAW], fd, DRM_IOCTL_SHARP_REDRAW, NULL);
+		}
+	}
+
+	close(fd);
+}
+
+// Page flips between the two framebuffers, and damage reports on bands
+// of the one being shown. Both are atomic commits in the driver
+static void commit_worker(struct stress_thread *t)
+{
+	struct stress_display *display = t->display;
+	struct drm_mode_crtc_page_flip flip;
+	struct drm_mode_fb_dirty_cmd dirty;
+	struct drm_clip_rect clip;
+	unsigned int y1, y2, phase = 0;
+	int back = 1;
+
+	while (!g_stop) {
+		y1 = rand_r(&t->seed) % display->height;
+		y2 = y1 + 1 + (rand_r(&t->seed) % (display->height - y1));
+		phase++;
+
+		if (rand_r(&t->seed) % 4) {
+			fill_rows(display, 0, y1, y2, phase);
+			clip.x1 = 0;
+			clip.y1 = y1;
+			clip.x2 = display->width;
+			clip.y2 = y2;
+			memset(&dirty, 0, sizeof(dirty));
+			dirty.fb_id = display->fb_ids[0];
+			dirty.num_clips = 1;
+			dirty.clips_ptr = (unsigned long)&clip;
+			timed_ioctl(&t->stats[OP_DIRTYFB], display->fd,
+				DRM_IOCTL_MODE_DIRTYFB, &dirty);
+		} else {
+			fill_rows(display, back, 0, display->height, phase);
+			memset(&flip, 0, sizeof(flip));
+			flip.crtc_id = display->crtc_id;
+			flip.fb_id = display->fb_ids[back];
+			if (!timed_ioctl(&t->stats[OP_PAGE_FLIP], display->fd,
+				DRM_IOCTL_MODE_PAGE_FLIP, &flip)) {
+				back = !back;
+			}
+		}
+	}
+}
+
+// Read the frame dump while everything else runs. Any dump must be
+// complete and well formed, contents are checked once writers stop
+static void frame_worker(struct stress_thread *t)
+{
+	struct frame frame = { 0 };
+	double start;
+	int rc;
+
+	while (!g_stop) {
+		start = now_us();
+		rc = read_frame(t->opts->frame_path, &frame);
+		if (t->stats[OP_FRAME_READ].count < SAMPLES_PER_OP) {
+			t->stats[OP_FRAME_READ].samples_us[t->stats[OP_FRAME_READ].count++]
+				= now_us() - start;
+		}
+		if (rc) {
+			t->stats[OP_FRAME_READ].errors++;
+			if (rc == -EPROTO) {
+				t->frame_errors++;
+			}
+		}
+		usleep(1000);
+	}
+
+	free(frame.bits);
+}
+
+static void *thread_main(void *arg)
+{
+	struct stress_thread *t = arg;
+
+	// Thread 0 checks frames, the others split between roles
+	if (t->index == 0) {
+		frame_worker(t);
+	} else if (t->display->ready && ((t->index % 3) == 0)) {
+		commit_worker(t);
+	} else if ((t->index % 3) == 2) {
+		redraw_worker(t);
+	} else {
+		overlay_worker(t);
+	}
+
+	return NULL;
+}
+
+/* Plane-only commits */
+
+// Values of the "type" plane property
+#define PLANE_TYPE_OVERLAY 0
+#define PLANE_TYPE_CURSOR 2
+
+enum plane_prop
+{
+	PROP_FB_ID,
+	PROP_CRTC_ID,
+	PROP_SRC_X,
+	PROP_SRC_Y,
+	PROP_SRC_W,
+	PROP_SRC_H,
+	PROP_CRTC_X,
+	PROP_CRTC_Y,
+	PROP_CRTC_W,
+	PROP_CRTC_H,
+	PROP_TYPE,
+	NUM_PLANE_PROPS
+};
+
+static char const *plane_prop_names[NUM_PLANE_PROPS] = {
+	"FB_ID", "CRTC_ID", "SRC_X", "SRC_Y", "SRC_W", "SRC_H",
+	"CRTC_X", "CRTC_Y", "CRTC_W", "CRTC_H", "type",
+};
+
+// Look up the property IDs of `plane_id` and its type
+static int get_plane_props(int fd, unsigned int plane_id,
+	unsigned int *prop_ids, unsigned long long *type)
+{
+	struct drm_mode_obj_get_properties obj;
+	struct drm_mode_get_property prop;
+	unsigned int ids[64];
+	unsigned long long values[64];
+	unsigned int i, n, found = 0;
+	int rc;
+
+	memset(&obj, 0, sizeof(obj));
+	obj.obj_id = plane_id;
+	obj.obj_type = DRM_MODE_OBJECT_PLANE;
+	obj.count_props = 64;
+	obj.props_ptr = (unsigned long)ids;
+	obj.prop_values_ptr = (unsigned long)values;
+	if ((rc = xioctl(fd, DRM_IOCTL_MODE_OBJ_GETPROPERTIES, &obj))) {
+		return rc;
+	}
+
+	for (i = 0; (i < obj.count_props) && (i < 64); i++) {
+		memset(&prop, 0, sizeof(prop));
+		prop.prop_id = ids[i];
+		if ((rc = xioctl(fd, DRM_IOCTL_MODE_GETPROPERTY, &prop))) {
+			return rc;
+		}
+		for (n = 0; n < NUM_PLANE_PROPS; n++) {
+			if (!strcmp(prop.name, plane_prop_names[n])) {
+				prop_ids[n] = ids[i];
+				found |= 1 << n;
+				if (n == PROP_TYPE) {
+					*type = values[i];
+				}
+			}
+		}
+	}
+
+	return (found == (1 << NUM_PLANE_PROPS) - 1) ? 0 : -ENOENT;
+}
+
+static int find_plane(int fd, unsigned long long type, unsigned int *plane_id,
+	unsigned int *prop_ids)
+{
+	struct drm_mode_get_plane_res res;
+	unsigned int ids[16];
+	unsigned long long plane_type = ~0ULL;
+	unsigned int i;
+	int rc;
+
+	memset(&res, 0, sizeof(res));
+	res.count_planes = 16;
+	res.plane_id_ptr = (unsigned long)ids;
+	if ((rc = xioctl(fd, DRM_IOCTL_MODE_GETPLANERESOURCES, &res))) {
+		return rc;
+	}
+
+	for (i = 0; (i < res.count_planes) && (i < 16); i++) {
+		if (!get_plane_props(fd, ids[i], prop_ids, &plane_type)
+		 && (plane_type == type)) {
+			*plane_id = ids[i];
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+// Wait for the flip event of the last commit
+static int wait_flip_event(int fd, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	char buf[1024];
+	struct drm_event const *event;
+	ssize_t len, pos;
+
+	while (poll(&pfd, 1, timeout_ms) > 0) {
+		if ((len = read(fd, buf, sizeof(buf))) <= 0) {
+			return -EIO;
+		}
+		for (pos = 0; pos + (ssize_t)sizeof(*event) <= len; pos += event->length) {
+			event = (struct drm_event const *)&buf[pos];
+			if (event->type == DRM_EVENT_FLIP_COMPLETE) {
+				return 0;
+			}
+			if (!event->length) {
+				break;
+			}
+		}
+	}
+
+	return -ETIMEDOUT;
+}
+
+// Nonblocking commit of `plane_id` properties with a flip event, retried
+// while an earlier commit is pending
+static int commit_plane(int fd, unsigned int plane_id,
+	unsigned int const *prop_ids, unsigned long long const *values)
+{
+	struct drm_mode_atomic atomic;
+	unsigned int const count = PROP_TYPE;
+	double const deadline = now_us() + 1e6;
+	int rc;
+
+	do {
+		memset(&atomic, 0, sizeof(atomic));
+		atomic.flags = DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT;
+		atomic.count_objs = 1;
+		atomic.objs_ptr = (unsigned long)&plane_id;
+		atomic.count_props_ptr = (unsigned long)&count;
+		atomic.props_ptr = (unsigned long)prop_ids;
+		atomic.prop_values_ptr = (unsigned long)values;
+		rc = xioctl(fd, DRM_IOCTL_MODE_ATOMIC, &atomic);
+		if (rc == -EBUSY) {
+			usleep(1000);
+		}
+	} while ((rc == -EBUSY) && (now_us() < deadline));
+
+	return rc;
+}
+
+// Show and then hide a plane of `type` in commits that change nothing
+// else, and check that both flip events arrive
+static int plane_commit_check(struct stress_display const *display,
+	unsigned long long type, char const *name)
+{
+	unsigned int prop_ids[NUM_PLANE_PROPS], plane_id;
+	unsigned long long values[PROP_TYPE] = { 0 };
+	struct drm_set_client_cap cap;
+	struct drm_mode_create_dumb create;
+	struct drm_mode_destroy_dumb destroy;
+	struct drm_mode_fb_cmd2 cmd;
+	unsigned int const width = 32, height = 16;
+	double start;
+	int rc, step, failed = 0;
+
+	cap.capability = DRM_CLIENT_CAP_UNIVERSAL_PLANES;
+	cap.value = 1;
+	xioctl(display->fd, DRM_IOCTL_SET_CLIENT_CAP, &cap);
+	cap.capability = DRM_CLIENT_CAP_ATOMIC;
+	if (xioctl(display->fd, DRM_IOCTL_SET_CLIENT_CAP, &cap)
+	 || find_plane(display->fd, type, &plane_id, prop_ids)) {
+		printf("%s plane commit: no %s plane, skipped\n", name, name);
+		return 0;
+	}
+
+	// Contents don't matter, only the events
+	memset(&create, 0, sizeof(create));
+	create.width = width;
+	create.height = height;
+	create.bpp = (type == PLANE_TYPE_CURSOR) ? 32 : 8;
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_CREATE_DUMB, &create))) {
+		fprintf(stderr, "%s plane buffer: %s\n", name, strerror(-rc));
+		return 1;
+	}
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.width = width;
+	cmd.height = height;
+	cmd.pixel_format = (type == PLANE_TYPE_CURSOR)
+		? DRM_FORMAT_ARGB8888
+		: DRM_FORMAT_R8;
+	cmd.handles[0] = create.handle;
+	cmd.pitches[0] = create.pitch;
+	if ((rc = xioctl(display->fd, DRM_IOCTL_MODE_ADDFB2, &cmd))) {
+		fprintf(stderr, "%s plane framebuffer: %s\n", name, strerror(-rc));
+		failed = 1;
+		goto out_destroy;
+	}
+
+	// Show, then hide
+	for (step = 0; step < 2; step++) {
+		if (step == 0) {
+			values[PROP_FB_ID] = cmd.fb_id;
+			values[PROP_CRTC_ID] = display->crtc_id;
+			values[PROP_SRC_W] = (unsigned long long)width << 16;
+			values[PROP_SRC_H] = (unsigned long long)height << 16;
+			values[PROP_CRTC_X] = 8;
+			values[PROP_CRTC_Y] = 8;
+			values[PROP_CRTC_W] = width;
+			values[PROP_CRTC_H] = height;
+		} else {
+			memset(values, 0, sizeof(values));
+		}
+
+		start = now_us();
+		rc = commit_plane(display->fd, plane_id, prop_ids, values);
+		if (!rc) {
+			rc = wait_flip_event(display->fd, 1000);
+		}
+		printf("%s plane %s: ", name, (step == 0) ? "show" : "hide");
+		if (rc) {
+			printf("%s\n", strerror(-rc));
+			failed = 1;
+		} else {
+			printf("flip event after %.1f ms\n", (now_us() - start) / 1e3);
+		}
+	}
+
+	xioctl(display->fd, DRM_IOCTL_MODE_RMFB, &cmd.fb_id);
+out_destroy:
+	memset(&destroy, 0, sizeof(destroy));
+	destroy.handle = create.handle;
+	xioctl(display->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &destroy);
+
+	return failed;
+}
+
+/* Final check */
+
+static int read_param(char const *name)
+{
+	char path[128];
+	FILE *f;
+	int value = 0;
+
+	snprintf(path, sizeof(path), "/sys/module/sharp_drm/parameters/%s", name);
+	if ((f = fopen(path, "r")) != NULL) {
+		if (fscanf(f, "%d", &value) != 1) {
+			value = 0;
+		}
+		fclose(f);
+	}
+
+	return value;
+}
+
+// Count pixels of the frame that don't match `expect`, waiting for queued
+// transfers to catch up first
+static long check_frame(char const *path, int (*expect)(void *, int, int),
+	void *ctx)
+{
+	struct frame frame = { 0 };
+	double const deadline = now_us() + 2e6;
+	long bad = 0;
+	int x, y, first_x = -1, first_y = -1;
+
+	do {
+		if (read_frame(path, &frame)) {
+			free(frame.bits);
+			return -1;
+		}
+
+		bad = 0;
+		for (y = 0; y < frame.height; y++) {
+			for (x = 0; x < frame.width; x++) {
+				if (frame_white(&frame, x, y) != expect(ctx, x, y)) {
+					if (!bad++) {
+						first_x = x;
+						first_y = y;
+					}
+				}
+			}
+		}
+
+		if (bad) {
+			usleep(10000);
+		}
+	} while (bad && (now_us() < deadline));
+
+	if (bad) {
+		fprintf(stderr, "  first mismatch at %d,%d\n", first_x, first_y);
+	}
+
+	free(frame.bits);
+
+	return bad;
+}
+
+struct expect_ctx
+{
+	int scale;
+	int invert;
+	int ov_x, ov_y, ov_w, ov_h;
+	int with_overlay;
+};
+
+static int expect_pattern(void *ctx_, int x, int y)
+{
+	struct expect_ctx const *ctx = ctx_;
+	int white;
+
+	if (ctx->with_overlay && (ctx->ov_x <= x) && (x < ctx->ov_x + ctx->ov_w)
+	 && (ctx->ov_y <= y) && (y < ctx->ov_y + ctx->ov_h)) {
+		white = ((x - ctx->ov_x) / 4) % 2; // Stripes
+	} else {
+		white = ((x / ctx->scale) / 8 + (y / ctx->scale) / 8) % 2;
+	}
+
+	return white ^ ctx->invert;
+}
+
+// Draw a known framebuffer, then a known overlay over it, then remove it,
+// and compare the dump at each step
+static int final_check(struct stress_options const *opts,
+	struct stress_display *display)
+{
+	struct expect_ctx ctx = { .scale = 1, .ov_x = 40, .ov_y = 24,
+		.ov_w = 64, .ov_h = 32 };
+	struct drm_mode_fb_dirty_cmd dirty;
+	unsigned char pixels[64 * 32];
+	struct sharp_overlay_t ov;
+	union sharp_memory_ioctl_ov_add_t add;
+	union sharp_memory_ioctl_ov_show_t show;
+	long bad;
+	int fd, i, x, y, failed = 0;
+
+	ctx.invert = read_param("mono_invert");
+
+	// Either framebuffer may be shown after the last flip. Damage on the
+	// other one is ignored
+	if (display->ready) {
+		ctx.scale = opts->panel_width / display->width;
+		for (i = 0; i < 2; i++) {
+			fill_rows(display, i, 0, display->height, 0);
+			memset(&dirty, 0, sizeof(dirty));
+			dirty.fb_id = display->fb_ids[i];
+			xioctl(display->fd, DRM_IOCTL_MODE_DIRTYFB, &dirty);
+		}
+	}
+
+	if ((fd = open(opts->card, O_RDWR | O_CLOEXEC)) < 0) {
+		perror(opts->card);
+		return 1;
+	}
+
+	for (y = 0; y < ctx.ov_h; y++) {
+		for (x = 0; x < ctx.ov_w; x++) {
+			pixels[(y * ctx.ov_w) + x] = ((x / 4) % 2) ? 0xff : 0;
+		}
+	}
+	ov.x = ctx.ov_x;
+	ov.y = ctx.ov_y;
+	ov.width = ctx.ov_w;
+	ov.height = ctx.ov_h;
+	ov.pixels = pixels;
+	add.in_overlay = &ov;
+	show.in_handle = 0;
+	if (xioctl(fd, DRM_IOCTL_SHARP_OV_ADD, &add) == 0) {
+		show.in_handle = add.out_handle;
+	}
+	if (!show.in_handle || xioctl(fd, DRM_IOCTL_SHARP_OV_SHOW, &show)) {
+		fprintf(stderr, "could not show check overlay\n");
+		close(fd);
+		return 1;
+	}
+
+	// Without master, whatever the other client shows is unknown
+	if (!display->ready) {
+		printf("no framebuffer of our own, pixel checks skipped\n");
+	} else {
+		ctx.with_overlay = 1;
+		bad = check_frame(opts->frame_path, expect_pattern, &ctx);
+		printf("framebuffer and overlay: %ld bad pixels\n", bad);
+		failed |= (bad != 0);
+	}
+
+	// Closing the file hides and removes the overlay
+	close(fd);
+
+	if (display->ready) {
+		ctx.with_overlay = 0;
+		bad = check_frame(opts->frame_path, expect_pattern, &ctx);
+		printf("framebuffer after overlay removal: %ld bad pixels\n", bad);
+		failed |= (bad != 0);
+	}
+
+	return failed;
+}
+
+/* Report */
+
+static int compare_double(void const *a, void const *b)
+{
+	double const x = *(double const *)a, y = *(double const *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(double const *sorted, size_t n, double p)
+{
+	size_t i = (size_t)(p * (n - 1));
+
+	return sorted[i];
+}
+
+static void report(struct stress_thread *threads, int count, double elapsed_s)
+{
+	struct op_stats merged;
+	long frame_errors = 0;
+	int op, i;
+
+	printf("%-12s %10s %10s %9s %9s %9s %9s %7s %7s\n", "op", "calls",
+		"calls/s", "p50 us", "p99 us", "p99.9 us", "max us", "errors", "busy");
+
+	for (op = 0; op < NUM_OPS; op++) {
+		memset(&merged, 0, sizeof(merged));
+		for (i = 0; i < count; i++) {
+			merged.count += threads[i].stats[op].count;
+			merged.errors += threads[i].stats[op].errors;
+			merged.busy += threads[i].stats[op].busy;
+		}
+		if (!merged.count) {
+			continue;
+		}
+
+		merged.samples_us = malloc(merged.count * sizeof(double));
+		if (!merged.samples_us) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		merged.count = 0;
+		for (i = 0; i < count; i++) {
+			memcpy(&merged.samples_us[merged.count], threads[i].stats[op].samples_us,
+				threads[i].stats[op].count * sizeof(double));
+			merged.count += threads[i].stats[op].count;
+		}
+		qsort(merged.samples_us, merged.count, sizeof(double), compare_double);
+
+		printf("%-12s %10zu %10.0f %9.1f %9.1f %9.1f %9.1f %7ld %7ld\n",
+			op_names[op], merged.count, merged.count / elapsed_s,
+			percentile(merged.samples_us, merged.count, 0.50),
+			percentile(merged.samples_us, merged.count, 0.99),
+			percentile(merged.samples_us, merged.count, 0.999),
+			merged.samples_us[merged.count - 1], merged.errors, merged.busy);
+
+		free(merged.samples_us);
+	}
+
+	for (i = 0; i < count; i++) {
+		frame_errors += threads[i].frame_errors;
+	}
+	printf("malformed frame dumps: %ld\n", frame_errors);
+}
+
+int main(int argc, char **argv)
+{
+	struct stress_options opts = {
+		.card = "/dev/dri/card0",
+		.frame_path = "/sys/kernel/debug/sharp_drm/frame",
+		.threads = 8,
+		.seconds = 10,
+		.commits = 1,
+	};
+	struct stress_display display = { 0 };
+	struct stress_thread *threads;
+	struct drm_version version;
+	struct frame frame = { 0 };
+	char name[32] = { 0 };
+	double start, elapsed_s;
+	int c, i, op, rc, failed;
+
+	while ((c = getopt(argc, argv, "d:f:t:s:n")) != -1) {
+		switch (c) {
+		case 'd': opts.card = optarg; break;
+		case 'f': opts.frame_path = optarg; break;
+		case 't': opts.threads = atoi(optarg); break;
+		case 's': opts.seconds = atoi(optarg); break;
+		case 'n': opts.commits = 0; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if ((optind != argc) || (opts.threads < 2) || (opts.threads > MAX_THREADS)
+	 || (opts.seconds <= 0)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if ((display.fd = open(opts.card, O_RDWR | O_CLOEXEC)) < 0) {
+		perror(opts.card);
+		return 1;
+	}
+
+	memset(&version, 0, sizeof(version));
+	version.name = name;
+	version.name_len = sizeof(name) - 1;
+	if (xioctl(display.fd, DRM_IOCTL_VERSION, &version)
+	 || strcmp(name, "sharp-drm")) {
+		fprintf(stderr, "%s: not a sharp-drm device\n", opts.card);
+		return 1;
+	}
+
+	if (opts.commits && (rc = setup_display(&display))) {
+		fprintf(stderr, "display setup failed (%s), running without commits\n",
+			strerror(-rc));
+	}
+
+	if (read_frame(opts.frame_path, &frame)) {
+		fprintf(stderr, "%s: no frame dump, is debugfs mounted?\n",
+			opts.frame_path);
+		return 1;
+	}
+	opts.panel_width = frame.width;
+	opts.panel_height = frame.height;
+	free(frame.bits);
+
+	threads = calloc(opts.threads, sizeof(*threads));
+	if (!threads) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < opts.threads; i++) {
+		threads[i].index = i;
+		threads[i].seed = 1 + i;
+		threads[i].opts = &opts;
+		threads[i].display = &display;
+		for (op = 0; op < NUM_OPS; op++) {
+			threads[i].stats[op].samples_us = malloc(SAMPLES_PER_OP * sizeof(double));
+			if (!threads[i].stats[op].samples_us) {
+				fprintf(stderr, "out of memory\n");
+				return 1;
+			}
+		}
+	}
+
+	start = now_us();
+	for (i = 0; i < opts.threads; i++) {
+		if (pthread_create(&threads[i].thread, NULL, thread_main, &threads[i])) {
+			fprintf(stderr, "could not start thread %d\n", i);
+			g_stop = 1;
+			opts.threads = i;
+			break;
+		}
+	}
+
+	sleep(opts.seconds);
+	g_stop = 1;
+
+	for (i = 0; i < opts.threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+	}
+	elapsed_s = (now_us() - start) / 1e6;
+
+	report(threads, opts.threads, elapsed_s);
+	failed = 0;
+	if (display.ready) {
+		failed |= plane_commit_check(&display, PLANE_TYPE_OVERLAY, "overlay");
+		failed |= plane_commit_check(&display, PLANE_TYPE_CURSOR, "cursor");
+	}
+	failed |= final_check(&opts, &display);
+	printf("%s\n", (failed) ? "FAIL" : "PASS");
+
+	for (i = 0; i < opts.threads; i++) {
+		for (op = 0; op < NUM_OPS; op++) {
+			free(threads[i].stats[op].samples_us);
+		}
+	}
+	free(threads);
+	close(display.fd);
+
+	return failed;
+}